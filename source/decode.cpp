@@ -13,6 +13,8 @@
         tiles_32x32_rgba32_256x256.data
         WorldMap2D_19x13_rooms.bmp
 
+    Library: decode.h, one Decoder_t per map. Command line options: main.cpp
+
 NOTE: Solution > Properites > Debugging > Working directory should be set to:
     $(ProjectDir)data\
 */
@@ -26,14 +28,57 @@ NOTE: Solution > Properites > Debugging > Working directory should be set to:
 #include <stdio.h>  // printf(), fopen(), fclose()
 #include <string.h> // memset()
 #include <stdint.h> // uint8_t
+#include <limits.h> // INT_MAX
 #include <assert.h> // assert()
+#include <stdlib.h> // atoi()
+#include <errno.h>  // errno
+#include <math.h>   // sqrt(), ceil()
+
+#include <algorithm> // std::stable_sort()
+#include <atomic>   // std::atomic
+#include <chrono>   // std::chrono::steady_clock
+#include <condition_variable> // std::condition_variable
+#include <mutex>    // std::mutex
+#include <thread>   // std::thread
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #define SIMD_X86 1
+    #include <immintrin.h> // SSE2, AVX2
+    #if _MSC_VER
+        #include <intrin.h> // __cpuid()
+    #endif
+    #if __GNUC__ // GCC/Clang need per-function ISA, MSVC doesn't
+        #define TARGET_SSE2  __attribute__((target("sse2")))
+        #define TARGET_SSSE3 __attribute__((target("ssse3")))
+        #define TARGET_AVX2  __attribute__((target("avx2")))
+    #else
+        #define TARGET_SSE2
+        #define TARGET_SSSE3
+        #define TARGET_AVX2
+    #endif
+#endif
 
-//#include <unistd.h> // Unix: getcwd()
-#include <direct.h>   // Win: _getcwd()
 #if _WIN32
-    #define getcwd _getcwd
+    #include <direct.h>   // Win: _mkdir()
+    #include <sys/stat.h> // Win: _stat64()
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>  // Win: CreateFileMapping(), MapViewOfFile()
+    #include <psapi.h>    // Win: GetProcessMemoryInfo()
+#else
+    #include <unistd.h>   // Unix: close(), read()
+    #include <fcntl.h>    // Unix: open()
+    #include <sys/mman.h> // Unix: mmap(), munmap()
+    #include <sys/stat.h> // Unix: fstat(), stat(), mkdir()
+    #include <sys/resource.h> // Unix: getrusage()
+#endif
+
+#if __linux__
+    #include <linux/perf_event.h> // Linux: perf_event_attr
+    #include <sys/syscall.h>      // Linux: syscall(SYS_perf_event_open)
 #endif
 
+#include "decode.h"
+
 // Macros
 
 	// NOTE: ROW_H = TILE_W_px * TILE_H_px * ATLAS_W_tiles
@@ -75,27 +120,22 @@ NOTE: Solution > Properites > Debugging > Working directory should be set to:
 	const int ROOM2D_H_PX = TILE_H   * ROOM2D_H; // px
 	const int ROOM2D_Z    = ROOM2D_W * ROOM2D_H; // px
 
-	const int MAX_ROOM    = 250; // Disk has ~150 rooms, max World Size = 19x13 = 247
-
-	// 1. World Map 1x149 Rooms
-	const int    MAP1C_ROOM_W  =   1; // rooms
-	const int    MAP1C_ROOM_H  = 149;
-
-	const int    MAP1C_IMAGE_W = ROOM1C_W_PX * MAP1C_ROOM_W; // px
-	const int    MAP1C_IMAGE_H = ROOM1C_H_PX * MAP1C_ROOM_H;
+	const int MAX_ROOM    = 16384; // Disk has ~150 rooms, max World Size = 19x13 = 247. Synthetic -bench maps go to 100x
+	const int MAX_WORLD   = 32768; // World Map cells, so every pixel of the 2D World Map has an int index
+	static_assert( (int64_t) MAX_WORLD * ROOM2D_W_PX * ROOM2D_H_PX <= INT_MAX, "2D World Map pixels fit an int" );
 
-	const int    ROOM1C_PIXELS =     MAP1C_IMAGE_W * ROOM1C_H_PX  ; // 320x192 (8*8 * 40*24) = 61440
-	const size_t MAP1C_SIZE    = 4 * MAP1C_IMAGE_W * MAP1C_IMAGE_H; // 4 = RGBA channels
+	// NOTE: World Map dimensions are no longer hardcoded (1x149 and 19x13 rooms).
+	// They are derived from the map at run-time -- see WorldMeta_t and alloc_surface()
 
-	// 2. World Map 19x13 Rooms
-	const int    MAP2D_ROOW_W  = 19; // rooms
-	const int    MAP2D_ROOM_H  = 13;
+	// Windows .BMP
+	const int BMP_HEADER_SIZE  = 54; // "BM" + BITMAPFILEHEADER + BITMAPINFOHEADER
+	const int BMP_PALETTE_SIZE = 16; // color table entries of 8 and 4-bpp .BMP, the 16 CGA colors
 
-	const int    MAP2D_IMAGE_W = ROOM2D_W_PX * MAP2D_ROOW_W; // px
-	const int    MAP2D_IMAGE_H = ROOM2D_H_PX * MAP2D_ROOM_H;
-
-	const int    ROOM2D_PIXELS =     MAP2D_IMAGE_W * ROOM2D_H_PX  ; // 6080x200 (320*19 * 200) = 1216000
-	const size_t MAP2D_SIZE    = 4 * MAP2D_IMAGE_W * MAP2D_IMAGE_H; // 4 = RGBA channels
+	// Files
+	const char MAP_FILENAME[]   = "yhtwtg.map";             // default DecodeOptions_t::pMapFile
+	const char ATLAS_FILENAME[] = "tiles_raw_indexed.data"; // shared by every decoder, read once
+	const int  MAX_FILE_NAME    = 512;                      // output directory + file name
+	const int  MAX_DIR_NAME     = MAX_FILE_NAME - 128;      // leaves room for the longest generated name
 
 	// Tiles
 	//                           LE yyxx
@@ -130,38 +170,91 @@ NOTE: Solution > Properites > Debugging > Working directory should be set to:
 		const char *pDesc2;
 	};
 
+	// View of a file mapped into memory, read-only unless created by map_output_file()
+	struct MapView_t
+	{
+		uint8_t       *pData;
+		size_t         nSize;
+#if _WIN32
+		HANDLE         hFile;
+		HANDLE         hMapping;
+#endif
+	};
+
 	struct Room_t
 	{
-		int16_t*    pRoomData;
-		RoomDesc_t* pRoomDesc;
-		int         nRoomSize;
-		int         nRoomId;
-		int         nRoomX; // World Map
-		int         nRoomY; // World Map
+		const int16_t* pRoomData; // points into the mapped file
+		RoomDesc_t*    pRoomDesc;
+		int            nRoomSize;
+		int            nRoomId;
+		int            nRoomX; // World Map
+		int            nRoomY; // World Map
+		int            iLabel; // status line strip, see make_labels()
+	};
+
+	// Room transposed from the .map column-major order into row-major order.
+	// Each entry is the pixel offset of the tile in the texture atlas, -1 = invalid tile
+	struct RoomTiles_t
+	{
+		int aOffset[ ROOM1C_H ][ ROOM1C_W ];
 	};
 
 	struct WorldMeta_t
 	{
+		int nRooms;
 		int nMinRoomX;
 		int nMinRoomY;
 		int nMaxRoomX;
 		int nMaxRoomY;
-		int nMapWidth;
-		int nMapHeight;
+		int nMapWidth;  // rooms
+		int nMapHeight; // rooms
 	};
 
-// Globals
+	// Pixel formats. Colors are written as 0xAABBGGRR, i.e. bytes R,G,B,A in memory
+	struct RGBA_t // raw .data
+	{
+		typedef uint32_t Pixel;
+		static constexpr uint32_t convert (const uint32_t abgr) { return abgr; }
+	};
+
+	struct BGRA_t // Windows .BMP
+	{
+		typedef uint32_t Pixel;
+		static constexpr uint32_t convert (const uint32_t abgr) { return (abgr & 0xFF00FF00) | ((abgr >> 16) & 0xFF) | ((abgr & 0xFF) << 16); }
+	};
+
+	struct Index8_t // index into gPalette[]
+	{
+		typedef uint8_t Pixel;
+	};
 
-	// Map
-	size_t  gSize = 0;
-	uint8_t gRawMap[300 * K];
+	// Image allocated at run-time, sized in whole rooms
+	// Renderers only use pPixels + nPitch so any strided region can be a target
+	template<typename Format>
+	struct Surface_t
+	{
+		typedef typename Format::Pixel Pixel;
+
+		Pixel    *pPixels;
+		int       nRoomsW; // rooms
+		int       nRoomsH; // rooms
+		int       nWidth;  // px
+		int       nHeight; // px
+		int       nPitch;  // px per scanline
+		size_t    nSize;   // bytes
+	};
+	typedef Surface_t<RGBA_t  > Surface32_t;   // 32-bpp RGBA
+	typedef Surface_t<BGRA_t  > SurfaceBGRA_t; // 32-bpp BGRA
+	typedef Surface_t<Index8_t> Surface8_t;    //  8-bpp index into gPalette[]
 
-	MapHeader_t gMapHeader;
-	WorldMeta_t gWorldMeta;
+// Globals
 
-	// World Maps 1:1 Image
-	uint32_t        gWorldMap1D[ MAP1C_SIZE ];
-	uint32_t        gWorldMap2D[ MAP2D_SIZE ];
+	// -mmap: output file that a World Map is rendered into
+	struct OutputFile_t
+	{
+		MapView_t view;
+		char      sFileName[ MAX_FILE_NAME ];
+	};
 
 	// Room Descriptions
 	// Source file: Rooms_Normal.xml
@@ -341,15 +434,14 @@ NOTE: Solution > Properites > Debugging > Working directory should be set to:
 	};
 	const size_t NUM_ROOM_DESCRIPTIONS = sizeof(gRoomDescriptions) / sizeof(gRoomDescriptions[0]);
 
-	// Room Pointers
-	Room_t   gRooms[ MAX_ROOM ];
-
 	size_t   nTilesRawIndex = 0;
 	uint8_t  gTilesRawIndex[TILE_Z * NUM_TILE * 3]; // 3 bytes/pixel (RGB)
 	uint32_t gTilesRGBA    [TILE_Z * NUM_TILE    ]; // 4 bytes/pixel (RGBA)
+	uint32_t gTilesBGRA    [TILE_Z * NUM_TILE    ]; // 4 bytes/pixel (BGRA)
+	uint8_t  gTilesIndexed [TILE_Z * NUM_TILE    ]; // 1 byte /pixel (palette index)
 
 	// CGA Colors
-	uint32_t gPalette[16] =
+	constexpr uint32_t gPalette[16] =
 	{
 		//  aabbggrr
 		  0xFF000000 // 0 Black
@@ -370,6 +462,24 @@ NOTE: Solution > Properites > Debugging > Working directory should be set to:
 		, 0xFFffffff // F White
 	};
 
+	// The 16 CGA colors converted to a 32-bpp pixel format at compile time
+	template<typename Format>
+	struct Palette_t
+	{
+		static constexpr uint32_t aColor[16] =
+		{
+			  Format::convert( gPalette[ 0] ), Format::convert( gPalette[ 1] ), Format::convert( gPalette[ 2] ), Format::convert( gPalette[ 3] )
+			, Format::convert( gPalette[ 4] ), Format::convert( gPalette[ 5] ), Format::convert( gPalette[ 6] ), Format::convert( gPalette[ 7] )
+			, Format::convert( gPalette[ 8] ), Format::convert( gPalette[ 9] ), Format::convert( gPalette[10] ), Format::convert( gPalette[11] )
+			, Format::convert( gPalette[12] ), Format::convert( gPalette[13] ), Format::convert( gPalette[14] ), Format::convert( gPalette[15] )
+		};
+	};
+	template<typename Format> constexpr uint32_t Palette_t<Format>::aColor[16];
+
+	// Empty World Map cells are transparent (0x00000000), not palette black (0xFF000000).
+	// Any index with the high bit set expands to 0 -- this matches what pshufb does.
+	const uint8_t INDEX_TRANSPARENT = 0x80;
+
 	const int CGA_TILE_W     =  8; // px
 	const int CGA_TILE_H     =  8;
 	const int CGA_TILE_Z     = CGA_TILE_W * CGA_TILE_H;
@@ -382,6 +492,10 @@ NOTE: Solution > Properites > Debugging > Working directory should be set to:
 	const int CGA_ROW_H      = CGA_TILE_Z * CGA_ATLAS_W; // px
 
 	const int CGA_ATLAS_2D_Z = CGA_TILE_Z * CGA_ATLAS_Z; // px
+
+	const int CGA_LABEL_W    = CGA_TILE_W * ROOM1C_W;    // px, a room's status line: 40 glyphs
+	const int CGA_LABEL_Z    = CGA_LABEL_W * CGA_TILE_H; // px
+	static_assert( CGA_LABEL_W == ROOM2D_W_PX, "a status line is as wide as a room" );
 	uint32_t gRawCGAFont[ CGA_ATLAS_2D_Z ]; // raw 2D 256x64, 32-bpp
 
 	/*
@@ -435,7 +549,7 @@ NOTE: Solution > Properites > Debugging > Working directory should be set to:
 	//  CGA 2 http://2.bp.blogspot.com/-mO2qndnI8NI/VSHWTipp1hI/AAAAAAAACoQ/no-CMfAT5Jc/s1600/cga8x8b.png
 	//  Tandy http://4.bp.blogspot.com/-wEQ2dcm-TuE/VSHWXMMcJdI/AAAAAAAACpk/H3NaqJKGexE/s1600/t1k-8x8-437.png
 	*/
-	uint8_t gPackedFont8x8RGBA[ CGA_ATLAS_Z * 8 ] = // 1D, 256 glyphs * 1x8, 1-bpp
+	constexpr uint8_t gPackedFont8x8RGBA[ CGA_ATLAS_Z * 8 ] = // 1D, 256 glyphs * 1x8, 1-bpp
 	{   // https://int10h.org/oldschool-pc-fonts/fontlist/font?ibm_bios
 		// https://en.wikipedia.org/wiki/Code_page_437#Character_set
 		// https://upload.wikimedia.org/wikipedia/commons/f/f8/Codepage-437.png
@@ -697,41 +811,231 @@ NOTE: Solution > Properites > Debugging > Working directory should be set to:
 		,0x00,0x00,0x3C,0x3C,0x3C,0x3C,0x00,0x00 // FE ■
 		,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 // FF  
 	};
-	uint32_t gUnpackedFont8x8RGBA[ CGA_ATLAS_Z * CGA_TILE_Z ]; // linear 1D 256 glyphs 1x8, 32-bpp
 
-	// Tile Histogram
-	uint32_t gHistogram[65536]; // NOTE: Only tiles in texture atlas 0x00{00-1F} - 0x1F{00-1F} are used.
+	// 1-bpp glyph row -> 8 pixels, MSB = left most pixel.
+	// Byte x of aMask[ bits ] is 0xFF when pixel x is set: little endian, the same byte order as the pixels.
+	struct GlyphMasks_t
+	{
+		uint64_t aMask[ 256 ];
+	};
+
+	// ========================================
+	constexpr GlyphMasks_t make_glyph_masks ()
+	{
+		GlyphMasks_t masks = {};
+		for (int bits = 0; bits < 256; ++bits)
+			for (int x = 0; x < CGA_TILE_W; ++x)
+				if (bits & (0x80 >> x))
+					masks.aMask[ bits ] |= 0xFFull << (8*x);
+		return masks;
+	}
+
+	constexpr GlyphMasks_t gGlyphMasks = make_glyph_masks();
+	constexpr const uint64_t (&gaGlyphMask)[ 256 ] = gGlyphMasks.aMask;
+
+	struct UnpackedFont_t
+	{
+		uint32_t aRGBA   [ CGA_ATLAS_Z * CGA_TILE_Z ]; // linear 1D 256 glyphs 1x8, 32-bpp
+		uint8_t  aIndexed[ CGA_ATLAS_Z * CGA_TILE_Z ]; // linear 1D 256 glyphs 1x8,  8-bpp palette index
+	};
+
+	// Unpack linear 1-bpp font into linear 32-bpp and 8-bpp fonts, at compile time
+	// ========================================
+	constexpr UnpackedFont_t unpack_CGA_font ()
+	{
+		UnpackedFont_t font = {};
+		for (int iRow = 0; iRow < CGA_ATLAS_Z * CGA_TILE_H; ++iRow)
+		{
+			const uint64_t mask = gaGlyphMask[ gPackedFont8x8RGBA[ iRow ] ];
+			for (int x = 0; x < CGA_TILE_W; ++x)
+			{
+				const uint8_t color = (uint8_t)(mask >> (8*x)) & 15; // white : black
+				font.aRGBA   [ iRow*CGA_TILE_W + x ] = gPalette[ color ]; // NOTE: black and white are the same in RGBA and BGRA
+				font.aIndexed[ iRow*CGA_TILE_W + x ] = color;
+			}
+		}
+		return font;
+	}
+
+	constexpr UnpackedFont_t gUnpackedFont = unpack_CGA_font();
+	constexpr const uint32_t (&gUnpackedFont8x8RGBA   )[ CGA_ATLAS_Z * CGA_TILE_Z ] = gUnpackedFont.aRGBA;
+	constexpr const uint8_t  (&gUnpackedFont8x8Indexed)[ CGA_ATLAS_Z * CGA_TILE_Z ] = gUnpackedFont.aIndexed;
+
+	// What the renderers read: the converted atlas and unpacked font above, or a mapped baked world (see load_baked())
+	struct Assets_t
+	{
+		const uint32_t *pTilesRGBA;
+		const uint32_t *pTilesBGRA;
+		const uint8_t  *pTilesIndexed;
+		const uint32_t *pFontRGBA;
+		const uint8_t  *pFontIndexed;
+	};
+	Assets_t gAssets = { gTilesRGBA, gTilesBGRA, gTilesIndexed, gUnpackedFont8x8RGBA, gUnpackedFont8x8Indexed };
+
+	// Tile Histogram: one counter per atlas tile, by dense index, see get_tile_index()
+	const int HISTOGRAM_SIZE = NUM_TILE;
+
+	// -metrics: what a run cost, written as JSON for tracking across map versions and builds, see write_metrics()
+	const int MAX_STAGE = 16;
+
+	// -perf
+	enum PerfCounter_e
+	{
+		  PERF_CYCLES
+		, PERF_INSTRUCTIONS
+		, PERF_CACHE_MISSES
+		, PERF_BRANCH_MISSES
+		, NUM_PERF
+	};
+	const char    *gaPerfName[ NUM_PERF ] = { "cycles", "instructions", "cache_misses", "branch_misses" };
+	const uint64_t PERF_NONE = ~0ull; // counter not available
+
+	struct PerfCounters_t
+	{
+		uint64_t aCount[ NUM_PERF ];
+	};
+
+	struct MetricsStage_t
+	{
+		const char    *pName;
+		double         nSecs;
+		PerfCounters_t perf; // -perf
+	};
+
+	struct Metrics_t
+	{
+		std::chrono::steady_clock::time_point tStart;
+		std::chrono::steady_clock::time_point tStage;
+		PerfCounters_t        perfStage;     // -perf: counters when tStage was taken
+		MetricsStage_t        aStage[ MAX_STAGE ];
+		int                   nStages;
+		double                nRenderSecs;   // drawing the rooms, for rooms/s
+		std::atomic<uint64_t> nBytesRead;
+		std::atomic<uint64_t> nBytesWritten; // -dzi tiles are written from several threads
+		int                   aPerfFd[ NUM_PERF ]; // -perf: counters of the thread that created the decoder
+	};
+
+	// Room status lines, one CGA_LABEL_W x CGA_TILE_H px strip per distinct title, see make_labels()
+	struct Labels_t
+	{
+		int       nLabels;
+		uint32_t *aRGBA;    // [ nLabels ][ CGA_TILE_H ][ CGA_LABEL_W ] black & white, so also BGRA
+		uint8_t  *aIndexed; // [ nLabels ][ CGA_TILE_H ][ CGA_LABEL_W ] palette index
+	};
+
+	// Everything about one map. Nothing here is shared between decoders: the atlas, font,
+	// palettes and blitter above are, and are read-only once init_shared() / load_assets() ran.
+	struct Decoder_t
+	{
+		DecodeOptions_t options;
+		const char     *pMapFile;
+		char            sOutputDir[ MAX_DIR_NAME ]; // "" or options.pOutputDir + '/', prefix of every output file
+
+		// Map
+		MapView_t       map;        // the .map, or the baked world with -baked. No size limit
+		MapHeader_t     mapHeader;
+		WorldMeta_t     world;
+		Room_t         *aRooms;     // [ world.nRooms ], point into the map
+		int            *aRoomIndex; // [nMapHeight][nMapWidth] World Map cell -> iRoom, -1 = empty. See index_rooms()
+		uint64_t       *aRoomHash;  // -incremental: [ world.nRooms ], see hash_rooms()
+		int            *aRoomDedup; // [ world.nRooms ] lowest room with the same tiles, itself if none. See dedup_rooms()
+		RoomDesc_t     *aBakedDesc; // -baked: [ world.nRooms ] titles that point into the mapping
+		Assets_t        assets;     // gAssets, or the baked world's own atlas and font
+		Labels_t        labels;
+
+		// World Maps 1:1 Image
+		Surface32_t     worldMap1D; // 1 x nRooms                  , i.e. 1x149 =   320 x 28608 px
+		Surface32_t     worldMap2D; // nMapWidth x nMapHeight rooms, i.e. 19x13 = 6,080 x  2600 px
+
+		// World Maps 1:1 Image, palette indexed. 1/4 the memory traffic of the 32-bpp maps
+		Surface8_t      indexMap1D;
+		Surface8_t      indexMap2D;
+
+		// World Map 2D rendered in .BMP byte order when no raw RGBA .data is wanted
+		SurfaceBGRA_t   bitmap2D;
+
+		// -mmap: the files the World Maps above are rendered into
+		OutputFile_t    output1D;
+		OutputFile_t    output2D;
+		OutputFile_t    outputBMP;
+
+		// Tile Histogram
+		uint32_t        aHistogram[ HISTOGRAM_SIZE ]; // [ YY*ATLAS_W + XX ] of tile 0xYYXX, only tiles in the texture atlas are counted
+
+		Metrics_t       metrics;
+	};
 
 // Prototypes _________________________________________________________
 
-	void draw_text_centered(const char *pText, const int iRoomX, const int iRoomY);
-	void draw_tile(int16_t tile, const int dst_tile_x, const int dst_tile_y);
-	void read_map();
-	void read_tiles8bpp();
+	int  get_tile_offset(const int16_t iTile, const int iDstX, const int iDstY);
+	int  get_tile_index(const int16_t iTile);
+	template<typename Format>
+	void draw_tile(const Decoder_t *pDecoder, Surface_t<Format> *pSurface, const int16_t iTile, const int iDstX, const int iDstY);
+	void draw_tile(const Decoder_t *pDecoder, Surface8_t        *pSurface, const int16_t iTile, const int iDstX, const int iDstY);
+	bool read_map(Decoder_t *pDecoder);
+	void read_tiles8bpp(Decoder_t *pDecoder);
+	void unmap_file(MapView_t* pView);
+	uint32_t make_bitmap_header(uint8_t *pHeader, const int nWidth, const int nHeight, const int nBits = 32);
+	double end_stage(Decoder_t *pDecoder, const char *pName);
+	void write_metrics(Decoder_t *pDecoder);
 
 // Utils ______________________________________________________________
 
 	// ========================================
-	void convert_tiles_8bpp_32rgba ()
+	template<typename Format>
+	void convert_tiles_8bpp (uint32_t *dst)
 	{
 		uint8_t * src = gTilesRawIndex;
-		uint32_t* dst = gTilesRGBA;
 
 		for (int y = 0; y < ATLAS_IMAGE_H; ++y)
 			for (int x = 0; x < ATLAS_IMAGE_W; ++x)
-				*dst++ = gPalette[*src++ & 0xF]; // 16 colors in palette
+				*dst++ = Palette_t<Format>::aColor[*src++ & 0xF]; // 16 colors in palette
+	}
+
+	// Convert the raw atlas into pRGBA and pBGRA, ATLAS_IMAGE_W x ATLAS_IMAGE_H px each
+	// ========================================
+	void convert_tiles_8bpp_32rgba (uint32_t *pRGBA, uint32_t *pBGRA)
+	{
+		convert_tiles_8bpp<RGBA_t>( pRGBA );
+		convert_tiles_8bpp<BGRA_t>( pBGRA );
+	}
+
+	// ========================================
+	void convert_tiles_8bpp_indexed (uint8_t *pIndexed)
+	{
+		for (int i = 0; i < ATLAS_IMAGE_W * ATLAS_IMAGE_H; ++i)
+			pIndexed[ i ] = gTilesRawIndex[ i ] & 0xF; // 16 colors in palette
+	}
+
+	// ========================================
+	const int16_t *get_map_start (const Decoder_t *pDecoder)
+	{
+		return (const int16_t*)(pDecoder->map.pData); // 2 byte header is starting player room
+	}
+
+	// Returns true if a World Map of nMapWidth x nMapHeight rooms can be sized without overflow.
+	// Room positions come straight from the file as int32, so the extents are only bounded here.
+	// ========================================
+	bool is_world_in_bounds (const int64_t nMapWidth, const int64_t nMapHeight)
+	{
+		return (nMapWidth  > 0) && (nMapWidth  <= MAX_WORLD)
+		&&     (nMapHeight > 0) && (nMapHeight <= MAX_WORLD)
+		&&     (nMapWidth * nMapHeight <= MAX_WORLD);
 	}
 
+	// Number of bytes remaining in the map from pSrc to end of file
 	// ========================================
-	int16_t *get_map_start ()
+	size_t get_map_remain (const Decoder_t *pDecoder, const int16_t *pSrc)
 	{
-		return (int16_t*)(gRawMap); // 2 byte header is starting player room
+		size_t offset = (size_t)((const uint8_t*)pSrc - pDecoder->map.pData);
+		return (offset < pDecoder->map.nSize) ? pDecoder->map.nSize - offset : 0;
 	}
 
 	// ========================================
-	int get_map_int (int16_t *data)
+	int get_map_int (const int16_t *data)
 	{
-		int value = *((int32_t *) data);
+		int32_t value;
+		memcpy( &value, data, sizeof(value) ); // room headers are only 2-byte aligned
 		return value;
 	}
 
@@ -749,6 +1053,55 @@ NOTE: Solution > Properites > Debugging > Working directory should be set to:
 		return &gRoomDescriptions[0];
 	}
 
+	// Allocates a cleared surface of nRoomsW x nRoomsH rooms, each nRoomW_px x nRoomH_px
+	// ========================================
+	template<typename Format>
+	void alloc_surface (Surface_t<Format> *pSurface, const int nRoomsW, const int nRoomsH, const int nRoomW_px, const int nRoomH_px, const uint8_t nClear = 0)
+	{
+		pSurface->nRoomsW = nRoomsW;
+		pSurface->nRoomsH = nRoomsH;
+		pSurface->nWidth  = nRoomsW * nRoomW_px;
+		pSurface->nHeight = nRoomsH * nRoomH_px;
+		pSurface->nPitch  = pSurface->nWidth;
+		typedef typename Format::Pixel Pixel;
+
+		pSurface->nSize   = sizeof(Pixel) * (size_t)pSurface->nWidth * (size_t)pSurface->nHeight;
+		pSurface->pPixels = new Pixel[ pSurface->nSize / sizeof(Pixel) ];
+
+		memset( pSurface->pPixels, nClear, pSurface->nSize );
+	}
+
+	// Point a surface at pixels inside a memory-mapped output file.
+	// Bottom-up images (.BMP) start on the last scanline of the file and step back with a negative pitch.
+	// ========================================
+	template<typename Format>
+	void map_surface (Surface_t<Format> *pSurface, uint8_t *pPixels, const int nRoomsW, const int nRoomsH, const int nRoomW_px, const int nRoomH_px, const bool bBottomUp)
+	{
+		typedef typename Format::Pixel Pixel;
+
+		pSurface->nRoomsW = nRoomsW;
+		pSurface->nRoomsH = nRoomsH;
+		pSurface->nWidth  = nRoomsW * nRoomW_px;
+		pSurface->nHeight = nRoomsH * nRoomH_px;
+		pSurface->nPitch  = pSurface->nWidth;
+		pSurface->nSize   = sizeof(Pixel) * (size_t)pSurface->nWidth * (size_t)pSurface->nHeight;
+		pSurface->pPixels = (Pixel*) pPixels;
+
+		if (bBottomUp)
+		{
+			pSurface->pPixels += (size_t)(pSurface->nHeight - 1) * pSurface->nWidth;
+			pSurface->nPitch   = -pSurface->nWidth;
+		}
+	}
+
+	// ========================================
+	template<typename Format>
+	void free_surface (Surface_t<Format> *pSurface)
+	{
+		delete [] pSurface->pPixels;
+		memset( pSurface, 0, sizeof(*pSurface) );
+	}
+
 	// ========================================
 	size_t read_file (const char* pFilename, void* pBuffer, size_t nBufferSize)
 	{
@@ -771,522 +1124,4818 @@ NOTE: Solution > Properites > Debugging > Working directory should be set to:
 		return 0;
 	}
 
+	// Map a whole file read-only; returns false if it doesn't exist or is empty
 	// ========================================
-	void write_file (const char* pFilename, void* pBuffer, size_t nBufferSize)
+	bool map_file (const char* pFilename, MapView_t* pView)
 	{
-		FILE *out = fopen( pFilename, "w+b");
-		if (out)
-		{
-			size_t wrote = fwrite( pBuffer, 1, nBufferSize, out );
-			fclose( out );
-			if (!wrote)
-				printf( "ERROR: Wrote zero bytes!\n" );
-			if (wrote == nBufferSize)
-				printf( "Saved: %s\n", pFilename );
-		}
-		else
-			printf( "ERROR: Couldn't write: '%s'\n", pFilename );
-	}
-
-// Font _______________________________________________________________
+		memset( pView, 0, sizeof(*pView) );
 
-	// Generate gPackedFont8x8RGBA
-	// ========================================
-	void pack_CGA_font ()
-	{
-		// The game uses these two font files, CGA style, both which are incomplete:
-		//
-		//   PC_Senior_6.dds
-		//   PC_Senior_24.dds
-		//
-		// Saved as raw, 32-bpp, RGBA
-		if ( !read_file( "font_cga_256x64.data", gRawCGAFont, sizeof(gRawCGAFont)) )
-			return;
+		if (!pFilename)
+			return false;
 
-		uint32_t *pSrc = gRawCGAFont;
-		uint8_t  *pDst = gPackedFont8x8RGBA;
+#if _WIN32
+		pView->hFile = CreateFileA( pFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+		if (pView->hFile == INVALID_HANDLE_VALUE)
+		{
+			printf( "ERROR: Couldn't find: '%s'\n", pFilename );
+			pView->hFile = NULL;
+			return false;
+		}
 
-		// Linearize: 2D interleaved 8-bpp into linear 1D 1-bpp font
-		for (int iGlyph = 0; iGlyph < 256; ++iGlyph)
+		LARGE_INTEGER size;
+		if (GetFileSizeEx( pView->hFile, &size ) && size.QuadPart)
 		{
-			int iTileY = iGlyph / CGA_ATLAS_W;
-			int iTileX = iGlyph % CGA_ATLAS_W;
+			pView->hMapping = CreateFileMappingA( pView->hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+			if (pView->hMapping)
+			{
+				pView->pData = (uint8_t*) MapViewOfFile( pView->hMapping, FILE_MAP_READ, 0, 0, 0 );
+				pView->nSize = (size_t) size.QuadPart;
+			}
+		}
+#else
+		int fd = open( pFilename, O_RDONLY );
+		if (fd < 0)
+		{
+			printf( "ERROR: Couldn't find: '%s'\n", pFilename );
+			return false;
+		}
 
-			///Src = gRawCGAFont + (iTileY * CGA_ROW_H) + (iTileX * CGA_TILE_W);
-			pSrc = gRawCGAFont + GET_IMAGE_OFFSET( iTileX, iTileY, CGA_TILE_W, CGA_ROW_H );
-	printf( "\t\t" );
-			for (int y = 0; y < CGA_TILE_H; ++y)
+		struct stat info;
+		if ((fstat( fd, &info ) == 0) && info.st_size)
+		{
+			void *pData = mmap( NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+			if (pData != MAP_FAILED)
 			{
-				uint8_t bits = 0;
-				uint8_t mask = 0x80;
-				for (int x = 0; x < CGA_TILE_W; ++x, mask >>= 1)
-				{
-					if (*pSrc & 0xFF) // image is monochrome, only need to look at red channel
-						bits |= mask;
-					pSrc++;
-				}
-				*pDst++ = bits;
-	printf( ",0x%02X", bits);
-				pSrc -= CGA_TILE_W; // start of glyph
-				pSrc += CGA_ROW_W ; // next scan line in glyph
+				pView->pData = (uint8_t*) pData;
+				pView->nSize = (size_t) info.st_size;
 			}
-	printf( " // %02X %c U+????\n", iGlyph, (iGlyph < 0x1) ? ' ' : iGlyph );
 		}
+		close( fd ); // mapping stays valid after the descriptor is closed
+#endif
+
+		if (!pView->pData)
+		{
+			printf( "ERROR: Couldn't map: '%s'\n", pFilename );
+			unmap_file( pView );
+			return false;
+		}
+
+		return true;
 	}
 
-	// Unpack linear 1-bpp font into linear 32-bpp font
+	// Create a file of nSize bytes and map it read/write. New contents are all zero.
 	// ========================================
-	void unpack_CGA_font ()
+	bool map_output_file (const char* pFilename, const size_t nSize, MapView_t* pView)
 	{
-		uint8_t  *pSrc = gPackedFont8x8RGBA  ; // linear
-		uint32_t *pDst = gUnpackedFont8x8RGBA; // linear
+		memset( pView, 0, sizeof(*pView) );
 
-		for (int iGlyph = 0; iGlyph < CGA_ATLAS_Z; ++iGlyph)
+#if _WIN32
+		pView->hFile = CreateFileA( pFilename, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+		if (pView->hFile == INVALID_HANDLE_VALUE)
 		{
-			for (int y = 0; y < CGA_TILE_H; ++y)
+			printf( "ERROR: Couldn't write: '%s'\n", pFilename );
+			pView->hFile = NULL;
+			return false;
+		}
+
+		// Creating the mapping extends the file to nSize
+		pView->hMapping = CreateFileMappingA( pView->hFile, NULL, PAGE_READWRITE, (DWORD)((uint64_t)nSize >> 32), (DWORD)nSize, NULL );
+		if (pView->hMapping)
+		{
+			pView->pData = (uint8_t*) MapViewOfFile( pView->hMapping, FILE_MAP_WRITE, 0, 0, 0 );
+			pView->nSize = nSize;
+		}
+#else
+		int fd = open( pFilename, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+		if (fd < 0)
+		{
+			printf( "ERROR: Couldn't write: '%s'\n", pFilename );
+			return false;
+		}
+
+		if (ftruncate( fd, (off_t) nSize ) == 0)
+		{
+			void *pData = mmap( NULL, nSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+			if (pData != MAP_FAILED)
 			{
-				uint8_t bits = *pSrc++;
-				uint8_t mask = 0x80;
-				for (int x = 0; x < CGA_TILE_W; ++x, mask >>= 1)
-				{
-					if (bits & mask)
-						*pDst++ = gPalette[ 15 ]; // white
-					else
-						*pDst++ = gPalette[  0 ]; // black
-				}
+				pView->pData = (uint8_t*) pData;
+				pView->nSize = nSize;
 			}
 		}
-#ifdef SAVE_CGA_FONT
-	char sFileName[256];
-	sprintf( sFileName, "font_cga_rgba32_%dx%d.data", CGA_TILE_W, CGA_ROW_H );
-	write_file( sFileName, gUnpackedFont8x8RGBA, sizeof(gUnpackedFont8x8RGBA) );
+		close( fd );
 #endif
-	}
 
-// Main _______________________________________________________________
+		if (!pView->pData)
+		{
+			printf( "ERROR: Couldn't map: '%s'\n", pFilename );
+			unmap_file( pView );
+			return false;
+		}
 
-// copy from 1D World Map to 2D World Map
-// ========================================
-void copy_room (const int iSrcRoom, const int nDstRoomX, const int nDstRoomY )
-{
-    uint32_t *pSrc = gWorldMap1D + (iSrcRoom  * ROOM1C_PIXELS)                            ; // 1D 320x28608
-    uint32_t *pDst = gWorldMap2D + (nDstRoomY * ROOM2D_PIXELS) + (ROOM1C_W_PX * nDstRoomX); // 2D 6080x2600
+		return true;
+	}
 
-	for (int y = 0; y < ROOM1C_H_PX; ++y)
+	// ========================================
+	void unmap_file (MapView_t* pView)
 	{
-		memcpy( pDst, pSrc, ROOM1C_W_PX*4 ); // 4 = RGBA channels
-		pSrc += MAP1C_IMAGE_W;
-		pDst += MAP2D_IMAGE_W;
+#if _WIN32
+		if (pView->pData   ) UnmapViewOfFile( pView->pData );
+		if (pView->hMapping) CloseHandle( pView->hMapping );
+		if (pView->hFile   ) CloseHandle( pView->hFile    );
+#else
+		if (pView->pData   ) munmap( (void*) pView->pData, pView->nSize );
+#endif
+		memset( pView, 0, sizeof(*pView) );
 	}
-}
 
-// ========================================
-int count_rooms ()
-{
-	int16_t *pMap = get_map_start();
-	int16_t *pSrc = pMap;
+	// ========================================
+	bool seek_file (FILE *pFile, const uint64_t nOffset)
+	{
+#if _WIN32
+		return _fseeki64( pFile, (__int64) nOffset, SEEK_SET ) == 0;
+#else
+		return fseeko( pFile, (off_t) nOffset, SEEK_SET ) == 0;
+#endif
+	}
 
-	Room_t  *pRoom = gRooms;
-	int      iRoom = 0;
-	int      nRoom = 0;
+	// Returns the bytes written
+	// ========================================
+	size_t write_file (const char* pFilename, const void* pBuffer, size_t nBufferSize)
+	{
+		FILE *out = fopen( pFilename, "w+b");
+		if (out)
+		{
+			size_t wrote = fwrite( pBuffer, 1, nBufferSize, out );
+			fclose( out );
+			if (!wrote)
+				printf( "ERROR: Wrote zero bytes!\n" );
+			return wrote;
+		}
+		else
+			printf( "ERROR: Couldn't write: '%s'\n", pFilename );
 
-	memset( gRooms    , 0, sizeof(gRooms    ));
-	memset(&gMapHeader, 0, sizeof(gMapHeader));
-	memset(&gWorldMeta, 0, sizeof(gWorldMeta));
+		return 0;
+	}
 
-	gMapHeader = *((MapHeader_t*) pSrc );
-	pSrc += (sizeof(MapHeader_t)/2);
+	// write_file() of one of the decoder's outputs: counted in its metrics, logged unless -quiet
+	// ========================================
+	void save_file (Decoder_t *pDecoder, const char* pFilename, const void* pBuffer, size_t nBufferSize)
+	{
+		size_t wrote = write_file( pFilename, pBuffer, nBufferSize );
+		pDecoder->metrics.nBytesWritten += wrote;
+		if ((wrote == nBufferSize) && !pDecoder->options.bQuiet)
+			printf( "Saved: %s\n", pFilename );
+	}
 
-	if (gMapHeader.nVersion != META_version)
+	// 64-bit FNV-1a
+	// ========================================
+	uint64_t hash_bytes (const void *pData, const size_t nSize, uint64_t nHash = 0xCBF29CE484222325ull)
 	{
-		printf( "ERROR: Couldn't decode map!\n" );
-		return nRoom;
+		const uint8_t *pSrc = (const uint8_t*) pData;
+		for (size_t i = 0; i < nSize; ++i)
+			nHash = (nHash ^ pSrc[i]) * 0x100000001B3ull;
+		return nHash;
 	}
-	else
-#if 0 // obsolete redundant sanity checking -- see MAP_HEADER_IS_22_BYTES[]
-	if (sizeof(gMapHeader) != MAP_HEADER_SIZE)
+
+	// Polynomial hash of nCount tiles nStride apart, mod 2^64. Sliding the window one tile is
+	//   nHash*ROLL_BASE - first*ROLL_BASE^nCount + next
+	// so every window of a row or column is hashed in O(1), see fingerprint_room().
+	const uint64_t ROLL_BASE = 0x9E3779B97F4A7C15ull; // odd
+
+	// ========================================
+	uint64_t roll_hash (const int16_t *pTiles, const int nCount, const int nStride)
 	{
-		printf( "ERROR: Map header not 22 bytes!\n" );
-		return nRoom;
+		uint64_t nHash = 0;
+		for (int i = 0; i < nCount; ++i)
+			nHash = nHash*ROLL_BASE + (uint16_t) pTiles[ i*nStride ] + 1; // + 1: tile 0x0000 still counts
+		return nHash;
 	}
-	else
-#endif
+
+	// ========================================
+	uint64_t roll_power (const uint64_t nBase, const int nCount)
 	{
-		printf( "Map header:\n" );
-		printf( "  Found Player starting room: %d x %d\n", gMapHeader.nPlayerStartRoomX, gMapHeader.nPlayerStartRoomY );
-		printf( "  Uknown field 1: %d\n", gMapHeader.nUnknown1 );
-		printf( "  Uknown field 2: %d\n", gMapHeader.nUnknown2 );
-		printf( "  Total rooms   : %d\n", gMapHeader.nRooms    );
-		nRoom = gMapHeader.nRooms;
+		uint64_t nPower = 1;
+		for (int i = 0; i < nCount; ++i)
+			nPower *= nBase;
+		return nPower;
 	}
 
-	for( iRoom = 0; iRoom < nRoom; ++iRoom )
+	// Number of set bits, SWAR so it doesn't need the POPCNT instruction
+	// ========================================
+	int count_bits (uint64_t nBits)
 	{
-		pRoom->nRoomId   = iRoom;
-		pRoom->nRoomX    = get_map_int( pSrc + 0 );
-		pRoom->nRoomY    = get_map_int( pSrc + 2 );
+		nBits = nBits - ((nBits >> 1) & 0x5555555555555555ull);
+		nBits = (nBits & 0x3333333333333333ull) + ((nBits >> 2) & 0x3333333333333333ull);
+		nBits = (nBits + (nBits >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+		return (int)((nBits * 0x0101010101010101ull) >> 56);
+	}
+
+	// -threads #: 0 = one per core
+	// ========================================
+	int get_thread_count (const Decoder_t *pDecoder)
+	{
+		const int nThreads = (pDecoder->options.nThreads > 0) ? pDecoder->options.nThreads : (int) std::thread::hardware_concurrency();
+		return (nThreads > 0) ? nThreads : 1; // hardware_concurrency() is 0 if unknown
+	}
+
+	// Call fn( iItem, iWorker ) for every item in [0,nItems) on up to nThreads threads, the calling thread is worker 0.
+	// Workers pull the next item from a shared counter (dynamic load balancing), so items may take any time.
+	// iWorker < nThreads indexes per worker state such as a private histogram.
+	// ========================================
+	template<typename Fn>
+	void run_workers (const int nThreads, const int nItems, const Fn &fn)
+	{
+		const int nWorkers = (nThreads < nItems) ? nThreads : nItems;
+
+		std::atomic<int> iNextItem( 0 );
+		auto work = [&fn, &iNextItem, nItems]( const int iWorker )
+		{
+			for (int iItem = iNextItem++; iItem < nItems; iItem = iNextItem++)
+				fn( iItem, iWorker );
+		};
+
+		std::thread *aWorker = new std::thread[ (nWorkers > 1) ? nWorkers : 1 ];
+		for (int iWorker = 1; iWorker < nWorkers; ++iWorker)
+			aWorker[ iWorker ] = std::thread( work, iWorker );
+		work( 0 );
+		for (int iWorker = 1; iWorker < nWorkers; ++iWorker)
+			aWorker[ iWorker ].join();
+		delete [] aWorker;
+	}
+
+	// Size of a file in bytes, 0 if it doesn't exist
+	// ========================================
+	uint64_t get_file_size (const char* pFilename)
+	{
+#if _WIN32
+		struct _stat64 info;
+		if (_stat64( pFilename, &info ) != 0)
+			return 0;
+#else
+		struct stat info;
+		if (stat( pFilename, &info ) != 0)
+			return 0;
+#endif
+		return (uint64_t) info.st_size;
+	}
+
+	// Create a directory, it already existing is fine
+	// ========================================
+	bool make_directory (const char* pPath)
+	{
+#if _WIN32
+		if (_mkdir( pPath ) == 0)
+#else
+		if (mkdir( pPath, 0755 ) == 0)
+#endif
+			return true;
+
+		if (errno == EEXIST)
+			return true;
+
+		printf( "ERROR: Couldn't create directory: '%s'\n", pPath );
+		return false;
+	}
+
+// Blit _______________________________________________________________
+
+	// Copy an 8x8 block of 32-bpp pixels. A tile row is 8 px * 4 bytes = 32 bytes.
+	// Pitches are in pixels.
+	typedef void (*Blit8x8_t)(uint32_t *pDst, const int nDstPitch, const uint32_t *pSrc, const int nSrcPitch);
+
+	// 8-bpp: a tile row is only 8 bytes, a single 64-bit move
+	// ========================================
+	void blit_8x8_indexed (uint8_t *pDst, const int nDstPitch, const uint8_t *pSrc, const int nSrcPitch)
+	{
+		for (int y = 0; y < TILE_H; ++y)
+		{
+			memcpy( pDst, pSrc, TILE_W );
+
+			pSrc += nSrcPitch;
+			pDst += nDstPitch;
+		}
+	}
+
+	// Expand 8-bpp palette indices to 32-bpp using a 16 entry palette
+	typedef void (*ExpandIndexed_t)(uint32_t *pDst, const uint8_t *pSrc, const int nPixels, const uint32_t *pPalette);
+
+	// ========================================
+	void expand_indexed_scalar (uint32_t *pDst, const uint8_t *pSrc, const int nPixels, const uint32_t *pPalette)
+	{
+		for (int x = 0; x < nPixels; ++x)
+			pDst[x] = (pSrc[x] & INDEX_TRANSPARENT) ? 0 : pPalette[ pSrc[x] & 0xF ];
+	}
+
+	// Expand a 1-bpp scanline, MSB = left most pixel, to 32-bpp: set bits are nFore, clear bits nBack
+	typedef void (*ExpandBits_t)(uint32_t *pDst, const uint8_t *pBits, const int nBytes, const uint32_t nFore, const uint32_t nBack);
+
+	// ========================================
+	void expand_bits_scalar (uint32_t *pDst, const uint8_t *pBits, const int nBytes, const uint32_t nFore, const uint32_t nBack)
+	{
+		for (int i = 0; i < nBytes; ++i, pDst += 8)
+			for (int x = 0; x < 8; ++x)
+				pDst[x] = (pBits[i] & (0x80 >> x)) ? nFore : nBack;
+	}
+
+	// 8-bpp: the 8 pixels of a byte are a single 64-bit select with its gaGlyphMask
+	// ========================================
+	void expand_bits_indexed (uint8_t *pDst, const uint8_t *pBits, const int nBytes, const uint8_t nFore, const uint8_t nBack)
+	{
+		const uint64_t back = 0x0101010101010101ull * nBack;
+		const uint64_t diff = 0x0101010101010101ull * (uint8_t)(nFore ^ nBack);
+
+		for (int i = 0; i < nBytes; ++i, pDst += 8)
+		{
+			const uint64_t pixels = back ^ (gaGlyphMask[ pBits[i] ] & diff);
+			memcpy( pDst, &pixels, 8 ); // NOTE: Little endian, byte x = pixel x
+		}
+	}
+
+	// Halve a 32-bpp image: each output pixel is the rounded average of a 2x2 box, per channel.
+	// Reads 2*nDstPixels pixels from both source rows.
+	typedef void (*Downsample_t)(uint32_t *pDst, const uint32_t *pRow0, const uint32_t *pRow1, const int nDstPixels);
+
+	// ========================================
+	void downsample_2x2_scalar (uint32_t *pDst, const uint32_t *pRow0, const uint32_t *pRow1, const int nDstPixels)
+	{
+		for (int x = 0; x < nDstPixels; ++x)
+		{
+			uint32_t a = pRow0[2*x], b = pRow0[2*x+1];
+			uint32_t c = pRow1[2*x], d = pRow1[2*x+1];
+			uint32_t pixel = 0;
+
+			for (int shift = 0; shift < 32; shift += 8)
+			{
+				uint32_t sum = ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF) + ((c >> shift) & 0xFF) + ((d >> shift) & 0xFF);
+				pixel |= ((sum + 2) >> 2) << shift;
+			}
+			pDst[x] = pixel;
+		}
+	}
+
+	// ========================================
+	void blit_8x8_scalar (uint32_t *pDst, const int nDstPitch, const uint32_t *pSrc, const int nSrcPitch)
+	{
+		for (int y = 0; y < TILE_H; ++y)
+		{
+			for (int x = 0; x < TILE_W; ++x)
+				pDst[x] = pSrc[x];
+
+			pSrc += nSrcPitch;
+			pDst += nDstPitch;
+		}
+	}
+
+#if SIMD_X86
+	// 2x 16-byte load/store per tile row
+	// ========================================
+	TARGET_SSE2
+	void blit_8x8_sse2 (uint32_t *pDst, const int nDstPitch, const uint32_t *pSrc, const int nSrcPitch)
+	{
+		for (int y = 0; y < TILE_H; ++y)
+		{
+			__m128i lo = _mm_loadu_si128( (const __m128i*)(pSrc + 0) );
+			__m128i hi = _mm_loadu_si128( (const __m128i*)(pSrc + 4) );
+			_mm_storeu_si128( (__m128i*)(pDst + 0), lo );
+			_mm_storeu_si128( (__m128i*)(pDst + 4), hi );
+
+			pSrc += nSrcPitch;
+			pDst += nDstPitch;
+		}
+	}
+
+	// 1x 32-byte load/store per tile row
+	// ========================================
+	TARGET_AVX2
+	void blit_8x8_avx2 (uint32_t *pDst, const int nDstPitch, const uint32_t *pSrc, const int nSrcPitch)
+	{
+		for (int y = 0; y < TILE_H; ++y)
+		{
+			__m256i row = _mm256_loadu_si256( (const __m256i*)pSrc );
+			_mm256_storeu_si256( (__m256i*)pDst, row );
+
+			pSrc += nSrcPitch;
+			pDst += nDstPitch;
+		}
+	}
+
+	// Widen the 8 byte masks of gaGlyphMask to 32-bit masks with unpacks, then select: 2x 16-byte stores per byte of bits
+	// ========================================
+	TARGET_SSE2
+	void expand_bits_sse2 (uint32_t *pDst, const uint8_t *pBits, const int nBytes, const uint32_t nFore, const uint32_t nBack)
+	{
+		const __m128i back = _mm_set1_epi32( (int) nBack );
+		const __m128i diff = _mm_set1_epi32( (int)(nFore ^ nBack) );
+
+		for (int i = 0; i < nBytes; ++i, pDst += 8)
+		{
+			__m128i mask8  = _mm_loadl_epi64( (const __m128i*) &gaGlyphMask[ pBits[i] ] );
+			__m128i mask16 = _mm_unpacklo_epi8( mask8, mask8 );
+			__m128i lo     = _mm_unpacklo_epi16( mask16, mask16 ); // px 0-3
+			__m128i hi     = _mm_unpackhi_epi16( mask16, mask16 ); // px 4-7
+
+			_mm_storeu_si128( (__m128i*)(pDst + 0), _mm_xor_si128( back, _mm_and_si128( lo, diff ) ) );
+			_mm_storeu_si128( (__m128i*)(pDst + 4), _mm_xor_si128( back, _mm_and_si128( hi, diff ) ) );
+		}
+	}
+
+	// Sign extending the 8 byte masks gives the 8 32-bit masks directly: 1x 32-byte store per byte of bits
+	// ========================================
+	TARGET_AVX2
+	void expand_bits_avx2 (uint32_t *pDst, const uint8_t *pBits, const int nBytes, const uint32_t nFore, const uint32_t nBack)
+	{
+		const __m256i back = _mm256_set1_epi32( (int) nBack );
+		const __m256i diff = _mm256_set1_epi32( (int)(nFore ^ nBack) );
+
+		for (int i = 0; i < nBytes; ++i, pDst += 8)
+		{
+			__m256i mask = _mm256_cvtepi8_epi32( _mm_loadl_epi64( (const __m128i*) &gaGlyphMask[ pBits[i] ] ) );
+			_mm256_storeu_si256( (__m256i*) pDst, _mm256_xor_si256( back, _mm256_and_si256( mask, diff ) ) );
+		}
+	}
+
+	// Palette lookup with byte shuffles: each channel of the 16 colors fits in one 16-byte table.
+	// pshufb looks up 16 pixels of one channel at once, then unpacks interleave R,G,B,A back into pixels.
+	// ========================================
+	TARGET_SSSE3
+	void expand_indexed_ssse3 (uint32_t *pDst, const uint8_t *pSrc, const int nPixels, const uint32_t *pPalette)
+	{
+		uint8_t aChannel[4][16];
+		for (int i = 0; i < 16; ++i)
+			for (int c = 0; c < 4; ++c)
+				aChannel[c][i] = (uint8_t)(pPalette[i] >> (8*c));
+
+		const __m128i r    = _mm_loadu_si128( (const __m128i*)aChannel[0] );
+		const __m128i g    = _mm_loadu_si128( (const __m128i*)aChannel[1] );
+		const __m128i b    = _mm_loadu_si128( (const __m128i*)aChannel[2] );
+		const __m128i a    = _mm_loadu_si128( (const __m128i*)aChannel[3] );
+		const __m128i mask = _mm_set1_epi8( (char)(INDEX_TRANSPARENT | 0xF) );
+
+		int x = 0;
+		for ( ; x + 16 <= nPixels; x += 16)
+		{
+			__m128i index = _mm_and_si128( _mm_loadu_si128( (const __m128i*)(pSrc + x) ), mask );
+			__m128i R     = _mm_shuffle_epi8( r, index );
+			__m128i G     = _mm_shuffle_epi8( g, index );
+			__m128i B     = _mm_shuffle_epi8( b, index );
+			__m128i A     = _mm_shuffle_epi8( a, index );
+
+			__m128i RG_lo = _mm_unpacklo_epi8( R, G );
+			__m128i RG_hi = _mm_unpackhi_epi8( R, G );
+			__m128i BA_lo = _mm_unpacklo_epi8( B, A );
+			__m128i BA_hi = _mm_unpackhi_epi8( B, A );
+
+			_mm_storeu_si128( (__m128i*)(pDst + x +  0), _mm_unpacklo_epi16( RG_lo, BA_lo ) );
+			_mm_storeu_si128( (__m128i*)(pDst + x +  4), _mm_unpackhi_epi16( RG_lo, BA_lo ) );
+			_mm_storeu_si128( (__m128i*)(pDst + x +  8), _mm_unpacklo_epi16( RG_hi, BA_hi ) );
+			_mm_storeu_si128( (__m128i*)(pDst + x + 12), _mm_unpackhi_epi16( RG_hi, BA_hi ) );
+		}
+		expand_indexed_scalar( pDst + x, pSrc + x, nPixels - x, pPalette );
+	}
+
+	// Same as SSSE3 but 32 pixels at a time. Shuffles and unpacks are per 128-bit lane
+	// so the 4 results hold pixels {0-3,16-19}, {4-7,20-23}, ... and need a lane permute.
+	// ========================================
+	TARGET_AVX2
+	void expand_indexed_avx2 (uint32_t *pDst, const uint8_t *pSrc, const int nPixels, const uint32_t *pPalette)
+	{
+		uint8_t aChannel[4][16];
+		for (int i = 0; i < 16; ++i)
+			for (int c = 0; c < 4; ++c)
+				aChannel[c][i] = (uint8_t)(pPalette[i] >> (8*c));
+
+		const __m256i r    = _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i*)aChannel[0] ) );
+		const __m256i g    = _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i*)aChannel[1] ) );
+		const __m256i b    = _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i*)aChannel[2] ) );
+		const __m256i a    = _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i*)aChannel[3] ) );
+		const __m256i mask = _mm256_set1_epi8( (char)(INDEX_TRANSPARENT | 0xF) );
+
+		int x = 0;
+		for ( ; x + 32 <= nPixels; x += 32)
+		{
+			__m256i index = _mm256_and_si256( _mm256_loadu_si256( (const __m256i*)(pSrc + x) ), mask );
+			__m256i R     = _mm256_shuffle_epi8( r, index );
+			__m256i G     = _mm256_shuffle_epi8( g, index );
+			__m256i B     = _mm256_shuffle_epi8( b, index );
+			__m256i A     = _mm256_shuffle_epi8( a, index );
+
+			__m256i RG_lo = _mm256_unpacklo_epi8( R, G );
+			__m256i RG_hi = _mm256_unpackhi_epi8( R, G );
+			__m256i BA_lo = _mm256_unpacklo_epi8( B, A );
+			__m256i BA_hi = _mm256_unpackhi_epi8( B, A );
+
+			__m256i P0    = _mm256_unpacklo_epi16( RG_lo, BA_lo ); // px  0- 3, 16-19
+			__m256i P1    = _mm256_unpackhi_epi16( RG_lo, BA_lo ); // px  4- 7, 20-23
+			__m256i P2    = _mm256_unpacklo_epi16( RG_hi, BA_hi ); // px  8-11, 24-27
+			__m256i P3    = _mm256_unpackhi_epi16( RG_hi, BA_hi ); // px 12-15, 28-31
+
+			_mm256_storeu_si256( (__m256i*)(pDst + x +  0), _mm256_permute2x128_si256( P0, P1, 0x20 ) );
+			_mm256_storeu_si256( (__m256i*)(pDst + x +  8), _mm256_permute2x128_si256( P2, P3, 0x20 ) );
+			_mm256_storeu_si256( (__m256i*)(pDst + x + 16), _mm256_permute2x128_si256( P0, P1, 0x31 ) );
+			_mm256_storeu_si256( (__m256i*)(pDst + x + 24), _mm256_permute2x128_si256( P2, P3, 0x31 ) );
+		}
+		expand_indexed_scalar( pDst + x, pSrc + x, nPixels - x, pPalette );
+	}
+
+	// Widen to 16-bit channels, add the two rows, then add neighbouring pixels: 4 output pixels per loop
+	// ========================================
+	TARGET_SSE2
+	void downsample_2x2_sse2 (uint32_t *pDst, const uint32_t *pRow0, const uint32_t *pRow1, const int nDstPixels)
+	{
+		const __m128i zero  = _mm_setzero_si128();
+		const __m128i round = _mm_set1_epi16( 2 );
+
+		int x = 0;
+		for ( ; x + 4 <= nDstPixels; x += 4)
+		{
+			__m128i out[2];
+			for (int half = 0; half < 2; ++half)
+			{
+				__m128i r0 = _mm_loadu_si128( (const __m128i*)(pRow0 + 2*x + 4*half) ); // 4 source px
+				__m128i r1 = _mm_loadu_si128( (const __m128i*)(pRow1 + 2*x + 4*half) );
+
+				__m128i lo = _mm_add_epi16( _mm_unpacklo_epi8( r0, zero ), _mm_unpacklo_epi8( r1, zero ) ); // px 0,1
+				__m128i hi = _mm_add_epi16( _mm_unpackhi_epi8( r0, zero ), _mm_unpackhi_epi8( r1, zero ) ); // px 2,3
+
+				__m128i sum = _mm_add_epi16( _mm_unpacklo_epi64( lo, hi ), _mm_unpackhi_epi64( lo, hi ) ); // 0+1, 2+3
+				out[ half ] = _mm_srli_epi16( _mm_add_epi16( sum, round ), 2 );
+			}
+			_mm_storeu_si128( (__m128i*)(pDst + x), _mm_packus_epi16( out[0], out[1] ) );
+		}
+		downsample_2x2_scalar( pDst + x, pRow0 + 2*x, pRow1 + 2*x, nDstPixels - x );
+	}
+
+	// ========================================
+	bool cpu_has_ssse3 ()
+	{
+  #if _MSC_VER
+		int info[4];
+		__cpuid( info, 1 );
+		return (info[2] & (1 << 9)) != 0; // ECX bit 9 = SSSE3
+  #else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports( "ssse3" );
+  #endif
+	}
+
+	// CPU supports AVX2 and the OS saves YMM registers
+	// ========================================
+	bool cpu_has_avx2 ()
+	{
+  #if _MSC_VER
+		int info[4];
+		__cpuid( info, 0 );
+		if (info[0] < 7)
+			return false;
+
+		__cpuid( info, 1 );
+		const int OSXSAVE = (1 << 27);
+		if (!(info[2] & OSXSAVE) || ((_xgetbv( 0 ) & 6) != 6)) // XMM and YMM state
+			return false;
+
+		__cpuidex( info, 7, 0 );
+		return (info[1] & (1 << 5)) != 0; // EBX bit 5 = AVX2
+  #else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports( "avx2" );
+  #endif
+	}
+#endif // SIMD_X86
+
+	struct Blitter_t
+	{
+		const char     *pName;
+		Blit8x8_t       pBlit8x8;
+		ExpandIndexed_t pExpand;
+		Downsample_t    pDownsample;
+		ExpandBits_t    pExpandBits;
+	};
+
+	Blitter_t gBlitter = { "scalar", blit_8x8_scalar, expand_indexed_scalar, downsample_2x2_scalar, expand_bits_scalar };
+
+	// Expand a scanline of palette indices to a 32-bpp pixel format
+	// ========================================
+	template<typename Format>
+	void expand_row (uint32_t *pDst, const uint8_t *pSrc, const int nPixels)
+	{
+		gBlitter.pExpand( pDst, pSrc, nPixels, Palette_t<Format>::aColor );
+	}
+
+	// Pick the widest blitter this CPU supports
+	// ========================================
+	void init_blitter ()
+	{
+#if SIMD_X86
+		gBlitter.pName       = "sse2";
+		gBlitter.pBlit8x8    = blit_8x8_sse2;
+		gBlitter.pDownsample = downsample_2x2_sse2;
+		gBlitter.pExpandBits = expand_bits_sse2;
+
+		if (cpu_has_ssse3())
+		{
+			gBlitter.pName    = "ssse3";
+			gBlitter.pExpand  = expand_indexed_ssse3;
+		}
+
+		if (cpu_has_avx2())
+		{
+			gBlitter.pName       = "avx2";
+			gBlitter.pBlit8x8    = blit_8x8_avx2;
+			gBlitter.pExpand     = expand_indexed_avx2;
+			gBlitter.pExpandBits = expand_bits_avx2;
+		}
+#endif
+	}
+
+// Font _______________________________________________________________
+
+	// Generate gPackedFont8x8RGBA
+	// ========================================
+	void pack_CGA_font ()
+	{
+		// The game uses these two font files, CGA style, both which are incomplete:
+		//
+		//   PC_Senior_6.dds
+		//   PC_Senior_24.dds
+		//
+		// Saved as raw, 32-bpp, RGBA
+		if ( !read_file( "font_cga_256x64.data", gRawCGAFont, sizeof(gRawCGAFont)) )
+			return;
+
+		uint8_t   aPacked[ CGA_ATLAS_Z * 8 ]; // printed as the source of gPackedFont8x8RGBA
+		uint32_t *pSrc = gRawCGAFont;
+		uint8_t  *pDst = aPacked;
+
+		// Linearize: 2D interleaved 8-bpp into linear 1D 1-bpp font
+		for (int iGlyph = 0; iGlyph < 256; ++iGlyph)
+		{
+			int iTileY = iGlyph / CGA_ATLAS_W;
+			int iTileX = iGlyph % CGA_ATLAS_W;
+
+			///Src = gRawCGAFont + (iTileY * CGA_ROW_H) + (iTileX * CGA_TILE_W);
+			pSrc = gRawCGAFont + GET_IMAGE_OFFSET( iTileX, iTileY, CGA_TILE_W, CGA_ROW_H );
+	printf( "\t\t" );
+			for (int y = 0; y < CGA_TILE_H; ++y)
+			{
+				uint8_t bits = 0;
+				uint8_t mask = 0x80;
+				for (int x = 0; x < CGA_TILE_W; ++x, mask >>= 1)
+				{
+					if (*pSrc & 0xFF) // image is monochrome, only need to look at red channel
+						bits |= mask;
+					pSrc++;
+				}
+				*pDst++ = bits;
+	printf( ",0x%02X", bits);
+				pSrc -= CGA_TILE_W; // start of glyph
+				pSrc += CGA_ROW_W ; // next scan line in glyph
+			}
+	printf( " // %02X %c U+????\n", iGlyph, (iGlyph < 0x1) ? ' ' : iGlyph );
+		}
+	}
+
+#ifdef SAVE_CGA_FONT
+	// The font is unpacked at compile time, see unpack_CGA_font(); this only saves it
+	// ========================================
+	void save_CGA_font ()
+	{
+		char sFileName[ MAX_FILE_NAME ];
+		sprintf( sFileName, "font_cga_rgba32_%dx%d.data", CGA_TILE_W, CGA_ROW_H );
+		write_file( sFileName, gUnpackedFont8x8RGBA, sizeof(gUnpackedFont8x8RGBA) );
+	}
+#endif
+
+	// A room's status line: pText centered on 40 glyphs padded with blanks, expanded straight from the
+	// 1-bpp font one scanline of all 40 glyphs at a time into a 32-bpp and an 8-bpp strip.
+	// Glyphs past either end of the line are dropped.
+	// ========================================
+	void rasterize_label (uint32_t *pRGBA, uint8_t *pIndexed, const char *pText)
+	{
+		const int nCols  = CGA_LABEL_W / CGA_TILE_W;
+		const int nLen   = (int) strlen( pText );
+		const int iLeftX = (nCols - nLen)/2;
+
+		uint8_t aGlyph[ nCols ];
+		for (int iCol = 0; iCol < nCols; ++iCol)
+			aGlyph[ iCol ] = ((iCol >= iLeftX) && (iCol < iLeftX + nLen)) ? (uint8_t) pText[ iCol - iLeftX ] : ' ';
+
+		for (int y = 0; y < CGA_TILE_H; ++y, pRGBA += CGA_LABEL_W, pIndexed += CGA_LABEL_W)
+		{
+			uint8_t aBits[ nCols ]; // scanline y of every glyph
+			for (int iCol = 0; iCol < nCols; ++iCol)
+				aBits[ iCol ] = gPackedFont8x8RGBA[ aGlyph[ iCol ]*CGA_TILE_H + y ];
+
+			gBlitter.pExpandBits( pRGBA, aBits, nCols, gPalette[ 15 ], gPalette[ 0 ] ); // white on black
+			expand_bits_indexed( pIndexed, aBits, nCols, 15, 0 );
+		}
+	}
+
+	// ========================================
+	void free_labels (Labels_t *pLabels)
+	{
+		delete [] pLabels->aRGBA;
+		delete [] pLabels->aIndexed;
+		memset( pLabels, 0, sizeof(*pLabels) );
+	}
+
+// Main _______________________________________________________________
+
+// Returns the number of rooms found, -1 if their positions span a World Map too big to render
+// ========================================
+int count_rooms (Decoder_t *pDecoder)
+{
+	const int16_t *pMap = get_map_start( pDecoder );
+	const int16_t *pSrc = pMap;
+
+	int      iRoom = 0;
+	int      nRoom = 0;
+
+	delete [] pDecoder->aRooms;
+	pDecoder->aRooms = NULL;
+	memset(&pDecoder->mapHeader, 0, sizeof(pDecoder->mapHeader));
+	memset(&pDecoder->world    , 0, sizeof(pDecoder->world    ));
+
+	if (get_map_remain( pDecoder, pSrc ) < sizeof(MapHeader_t))
+	{
+		printf( "ERROR: Map is too small for header! %d bytes\n", (int) pDecoder->map.nSize );
+		return nRoom;
+	}
+
+	pDecoder->mapHeader = *((const MapHeader_t*) pSrc );
+	pSrc += (sizeof(MapHeader_t)/2);
+
+	if (pDecoder->mapHeader.nVersion != META_version)
+	{
+		printf( "ERROR: Couldn't decode map!\n" );
+		return nRoom;
+	}
+	else
+#if 0 // obsolete redundant sanity checking -- see MAP_HEADER_IS_22_BYTES[]
+	if (sizeof(pDecoder->mapHeader) != MAP_HEADER_SIZE)
+	{
+		printf( "ERROR: Map header not 22 bytes!\n" );
+		return nRoom;
+	}
+	else
+#endif
+	if (!pDecoder->options.bQuiet)
+	{
+		printf( "Map header:\n" );
+		printf( "  Found Player starting room: %d x %d\n", pDecoder->mapHeader.nPlayerStartRoomX, pDecoder->mapHeader.nPlayerStartRoomY );
+		printf( "  Uknown field 1: %d\n", pDecoder->mapHeader.nUnknown1 );
+		printf( "  Uknown field 2: %d\n", pDecoder->mapHeader.nUnknown2 );
+		printf( "  Total rooms   : %d\n", pDecoder->mapHeader.nRooms    );
+	}
+	nRoom = pDecoder->mapHeader.nRooms;
+
+	if (nRoom > MAX_ROOM)
+	{
+		printf( "ERROR: Map has too many rooms! %d > %d\n", nRoom, MAX_ROOM );
+		nRoom = MAX_ROOM;
+	}
+	if (nRoom < 0)
+		nRoom = 0;
+
+	pDecoder->aRooms = new Room_t[ nRoom ](); // () = zero initialize
+	Room_t *pRoom    = pDecoder->aRooms;
+
+	for( iRoom = 0; iRoom < nRoom; ++iRoom )
+	{
+		if (get_map_remain( pDecoder, pSrc ) < 2*(4 + ROOM1C_Z))
+		{
+			printf( "ERROR: Map truncated in room #%d @ %06X\n", iRoom, (int)(pSrc - pMap)*2 );
+			break;
+		}
+
+		pRoom->nRoomId   = iRoom;
+		pRoom->nRoomX    = get_map_int( pSrc + 0 );
+		pRoom->nRoomY    = get_map_int( pSrc + 2 );
 		pRoom->pRoomData = pSrc + 4;
 		pRoom->nRoomSize = ROOM1C_Z;
 		pRoom->pRoomDesc = get_room_description( pRoom->nRoomX, pRoom->nRoomY );
 
-		// Update world size
-		if (pRoom->nRoomX < gWorldMeta.nMinRoomX) gWorldMeta.nMinRoomX = pRoom->nRoomX;
-		if (pRoom->nRoomY < gWorldMeta.nMinRoomY) gWorldMeta.nMinRoomY = pRoom->nRoomY;
-		if (pRoom->nRoomX > gWorldMeta.nMaxRoomX) gWorldMeta.nMaxRoomX = pRoom->nRoomX;
-		if (pRoom->nRoomY > gWorldMeta.nMaxRoomY) gWorldMeta.nMaxRoomY = pRoom->nRoomY;
+		// Update world size
+		if (iRoom == 0)
+		{
+			pDecoder->world.nMinRoomX = pDecoder->world.nMaxRoomX = pRoom->nRoomX;
+			pDecoder->world.nMinRoomY = pDecoder->world.nMaxRoomY = pRoom->nRoomY;
+		}
+		if (pRoom->nRoomX < pDecoder->world.nMinRoomX) pDecoder->world.nMinRoomX = pRoom->nRoomX;
+		if (pRoom->nRoomY < pDecoder->world.nMinRoomY) pDecoder->world.nMinRoomY = pRoom->nRoomY;
+		if (pRoom->nRoomX > pDecoder->world.nMaxRoomX) pDecoder->world.nMaxRoomX = pRoom->nRoomX;
+		if (pRoom->nRoomY > pDecoder->world.nMaxRoomY) pDecoder->world.nMaxRoomY = pRoom->nRoomY;
+
+		if (!pDecoder->options.bQuiet)
+			printf( "@ %06X Room #%3d (%+3d x %+3d), Size: %d, %s\n",
+				(int)(pSrc - pMap)*2, pRoom->nRoomId, pRoom->nRoomX, pRoom->nRoomY, pRoom->nRoomSize, pRoom->pRoomDesc->pDesc );
+		pSrc += 4 + ROOM1C_Z;
+		pRoom++;
+	}
+
+	const int64_t nMapWidth  = ((int64_t) pDecoder->world.nMaxRoomX - pDecoder->world.nMinRoomX) + 1;
+	const int64_t nMapHeight = ((int64_t) pDecoder->world.nMaxRoomY - pDecoder->world.nMinRoomY) + 1;
+	if (!is_world_in_bounds( nMapWidth, nMapHeight ))
+	{
+		printf( "ERROR: World Map is too big! %lld x %lld rooms, max %d\n", (long long) nMapWidth, (long long) nMapHeight, MAX_WORLD );
+		memset(&pDecoder->world, 0, sizeof(pDecoder->world));
+		return -1;
+	}
+
+	pDecoder->world.nRooms     = iRoom;
+	pDecoder->world.nMapWidth  = (int) nMapWidth;
+	pDecoder->world.nMapHeight = (int) nMapHeight;
+
+	// NOTE: Unknown trailing map data
+	int offset = (int)(pSrc - pMap)*2;
+	int slack =  (int)(pDecoder->map.nSize - offset);
+	if (!pDecoder->options.bQuiet)
+		printf( "@ %06X Unknown map data: %d (0x%04X) bytes\n", offset, slack, slack );
+
+	return iRoom;
+};
+
+// Transpose the room's column-major tile indices into row-major atlas offsets.
+// The whole room is 40x24 x 2 bytes = 1,920 bytes so this stays in L1 cache.
+// ========================================
+bool prepare_room (const Decoder_t *pDecoder, RoomTiles_t *pTiles, const int iRoom, uint32_t *pHistogram)
+{
+	Room_t        *pRoom = &pDecoder->aRooms[ iRoom ];
+	const int16_t *pSrc  = pRoom->pRoomData;
+
+	if (pRoom->nRoomSize != ROOM1C_Z)
+	{
+		printf( "ERROR: Room size != %d tiles\n", ROOM1C_Z );
+		return false;
+	}
+
+	for (int x = 0; x < ROOM1C_W; x++)
+	{
+		for (int y = 0; y < ROOM1C_H; y++)
+		{
+			// Map contains Tiles that are in Little Endian format: xx yy
+			int16_t iTile = *pSrc++;
+			int     iIndex = get_tile_index( iTile );
+			if (pHistogram && (iIndex >= 0))
+				pHistogram[ iIndex ]++;
+			pTiles->aOffset[ y ][ x ] = get_tile_offset( iTile, x*TILE_W, y*TILE_H );
+		}
+	}
+
+	return true;
+}
+
+// ========================================
+const uint32_t* get_atlas (const Decoder_t *pDecoder, const Surface32_t   *) { return pDecoder->assets.pTilesRGBA   ; }
+const uint32_t* get_atlas (const Decoder_t *pDecoder, const SurfaceBGRA_t *) { return pDecoder->assets.pTilesBGRA   ; }
+const uint8_t * get_atlas (const Decoder_t *pDecoder, const Surface8_t    *) { return pDecoder->assets.pTilesIndexed; }
+
+// ========================================
+const uint32_t* get_label (const Decoder_t *pDecoder, const Surface32_t   *, const int iRoom) { return pDecoder->labels.aRGBA    + pDecoder->aRooms[ iRoom ].iLabel * CGA_LABEL_Z; }
+const uint32_t* get_label (const Decoder_t *pDecoder, const SurfaceBGRA_t *, const int iRoom) { return pDecoder->labels.aRGBA    + pDecoder->aRooms[ iRoom ].iLabel * CGA_LABEL_Z; } // black & white only, no swizzle needed
+const uint8_t * get_label (const Decoder_t *pDecoder, const Surface8_t    *, const int iRoom) { return pDecoder->labels.aIndexed + pDecoder->aRooms[ iRoom ].iLabel * CGA_LABEL_Z; }
+
+// Draw one full scanline of a room (320 px) left-to-right, iScanline = [0,192)
+// ========================================
+template<typename Surface, typename Pixel>
+void draw_room_scanline (const Decoder_t *pDecoder, const Surface *pSurface, Pixel *pDst, const RoomTiles_t &tiles, const int iScanline)
+{
+	const Pixel *pAtlas  = get_atlas( pDecoder, pSurface ) + (iScanline % TILE_H)*ATLAS_IMAGE_W;
+	const int   *pOffset = tiles.aOffset[ iScanline / TILE_H ];
+
+	for (int x = 0; x < ROOM1C_W; ++x, pDst += TILE_W)
+		if (pOffset[ x ] >= 0)
+			memcpy( pDst, pAtlas + pOffset[ x ], TILE_W * sizeof(Pixel) ); // one tile row, 8 px
+}
+
+// Draws room tiles directly into any surface with the room's top-left corner at nDstX, nDstY px
+// ========================================
+template<typename Surface>
+void draw_room (const Decoder_t *pDecoder, Surface *pSurface, const int iRoom, const int nDstX, const int nDstY, uint32_t *pHistogram)
+{
+#ifdef TUTORIAL // temp disable to dump raw rooms
+	int16_t  iTile;
+	const int16_t *pSrc;
+  #if TUTORIAL < 3
+    pSrc = (const int16_t*)(pDecoder->map.pData + iRoom*ROOM1C_Z);
+  #else // assume 30 byte map header, room has no header
+    pSrc = (const int16_t*)(pDecoder->map.pData + sizeof(MapHeader_t) + 8 + iRoom*ROOM1C_Z);
+    // 22 byte header, each room has an 8 byte header
+  #endif
+
+  #if TUTORIAL == 1
+	for (int y = 0; y < ROOM1C_H; y++)
+	{
+		for (int x = 0; x < ROOM1C_W; x++)
+		{
+  #else
+	for (int x = 0; x < ROOM1C_W; x++)
+	{
+		for (int y = 0; y < ROOM1C_H; y++)
+		{
+  #endif
+			// Map contains Tiles that are in Little Endian format: xx yy
+			iTile = *pSrc++;
+			if (pHistogram && (get_tile_index( iTile ) >= 0))
+				pHistogram[ get_tile_index( iTile ) ]++;
+			draw_tile( pDecoder, pSurface, iTile, nDstX + x*TILE_W, nDstY + y*TILE_H );
+		}
+	}
+#else
+	// The .map stores rooms column-major; drawing tiles in that order jumps 8 scanlines per tile.
+	// Instead transpose once, then write every destination scanline sequentially.
+	RoomTiles_t tiles;
+	if (!prepare_room( pDecoder, &tiles, iRoom, pHistogram ))
+		return;
+
+	auto *pDst = pSurface->pPixels + nDstY*pSurface->nPitch + nDstX;
+	for (int y = 0; y < ROOM1C_H_PX; ++y, pDst += pSurface->nPitch)
+		draw_room_scanline( pDecoder, pSurface, pDst, tiles, y );
+#endif
+}
+
+// Copy the room's cached status line below its tiles, room top-left at nDstX, nDstY px: one row copy per scanline
+// ========================================
+template<typename Surface>
+void draw_label (const Decoder_t *pDecoder, Surface *pSurface, const int iRoom, const int nDstX, const int nDstY)
+{
+	typedef typename Surface::Pixel Pixel;
+
+	const Pixel *pSrc   = get_label( pDecoder, pSurface, iRoom );
+	const int    nTextY = nDstY + ROOM2D_H_PX - CGA_TILE_H; // NOTE: Intentional inconsistency with Room1C_W and Room2D_H
+	Pixel       *pDst   = pSurface->pPixels + nTextY*pSurface->nPitch + nDstX;
+
+	for (int y = 0; y < CGA_TILE_H; ++y, pSrc += CGA_LABEL_W, pDst += pSurface->nPitch)
+		memcpy( pDst, pSrc, CGA_LABEL_W * sizeof(Pixel) );
+}
+
+// Draw a room with its name below it, top-left at nDstX, nDstY px
+// ========================================
+template<typename Surface>
+void draw_room_2D (const Decoder_t *pDecoder, Surface *pSurface, const int iRoom, const int nDstX, const int nDstY, uint32_t *pHistogram)
+{
+	draw_room( pDecoder, pSurface, iRoom, nDstX, nDstY, pHistogram );
+	draw_label( pDecoder, pSurface, iRoom, nDstX, nDstY );
+}
+
+// Copy the tiles of an already drawn room, without its status line
+// ========================================
+template<typename Surface>
+void copy_room (Surface *pSurface, const int nSrcX, const int nSrcY, const int nDstX, const int nDstY)
+{
+	const auto *pSrc = pSurface->pPixels + nSrcY*pSurface->nPitch + nSrcX;
+	      auto *pDst = pSurface->pPixels + nDstY*pSurface->nPitch + nDstX;
+
+	for (int y = 0; y < ROOM1C_H_PX; ++y, pSrc += pSurface->nPitch, pDst += pSurface->nPitch)
+		memcpy( pDst, pSrc, ROOM1C_W_PX * sizeof(*pDst) );
+}
+
+// ========================================
+void count_tiles (const Decoder_t *pDecoder, const int iRoom, uint32_t *pHistogram)
+{
+	const Room_t *pRoom = &pDecoder->aRooms[ iRoom ];
+	if (!pHistogram || (pRoom->nRoomSize != ROOM1C_Z))
+		return;
+
+	for (int iTile = 0; iTile < ROOM1C_Z; ++iTile)
+	{
+		const int iIndex = get_tile_index( pRoom->pRoomData[ iTile ] );
+		if (iIndex >= 0)
+			pHistogram[ iIndex ]++;
+	}
+}
+
+// Rooms can share a World Map cell, only the last one shows in the 2D World Map. See index_rooms()
+// ========================================
+bool is_room_shown (const Decoder_t *pDecoder, const int iRoom)
+{
+	if (!pDecoder->aRoomIndex)
+		return true;
+
+	const int nRoomX = pDecoder->aRooms[ iRoom ].nRoomX - pDecoder->world.nMinRoomX;
+	const int nRoomY = pDecoder->aRooms[ iRoom ].nRoomY - pDecoder->world.nMinRoomY;
+	return pDecoder->aRoomIndex[ nRoomY*pDecoder->world.nMapWidth + nRoomX ] == iRoom;
+}
+
+// Draw one room, and its name, into a 2D World Map and optional 1D World Map.
+// A duplicate room copies the pixels of the room it duplicates, which must be drawn already. Its 2D pixels are
+// only copied if that room is shown in its cell, else a later room has drawn over them.
+// A room hidden by a later room in the same cell is only counted and drawn in the 1D World Map,
+// so no two rooms ever write the same 2D pixels.
+// ========================================
+template<typename Surface>
+void draw_world_room (Decoder_t *pDecoder, Surface *p2D, Surface *p1D, const int iRoom, uint32_t *pHistogram)
+{
+	const WorldMeta_t &world = pDecoder->world;
+	const int          iSame = pDecoder->aRoomDedup ? pDecoder->aRoomDedup[ iRoom ] : iRoom;
+
+	int nRoomX = pDecoder->aRooms[ iRoom ].nRoomX - world.nMinRoomX; // remap [-10,-5] -> [0,0]
+	int nRoomY = pDecoder->aRooms[ iRoom ].nRoomY - world.nMinRoomY; // NOTE: undocumented rooms have no valid pDesc position
+
+	if (!is_room_shown( pDecoder, iRoom ))
+	{
+		count_tiles( pDecoder, iRoom, pHistogram );
+
+		if (p1D && p1D->pPixels)
+			draw_room( pDecoder, p1D, iRoom, 0, iRoom * ROOM1C_H_PX, NULL );
+		return;
+	}
+
+	if ((iSame != iRoom) && is_room_shown( pDecoder, iSame ))
+	{
+		const int nSameX = pDecoder->aRooms[ iSame ].nRoomX - world.nMinRoomX;
+		const int nSameY = pDecoder->aRooms[ iSame ].nRoomY - world.nMinRoomY;
+
+		count_tiles( pDecoder, iRoom, pHistogram );
+		copy_room( p2D, nSameX * ROOM2D_W_PX, nSameY * ROOM2D_H_PX, nRoomX * ROOM2D_W_PX, nRoomY * ROOM2D_H_PX );
+		draw_label( pDecoder, p2D, iRoom, nRoomX * ROOM2D_W_PX, nRoomY * ROOM2D_H_PX );
+	}
+	else // Single pass: tiles go straight into the 2D World Map, no intermediate copy
+		draw_room_2D( pDecoder, p2D, iRoom, nRoomX * ROOM2D_W_PX, nRoomY * ROOM2D_H_PX, pHistogram );
+
+	// Optional 1D World Map is rendered by the same path, every room is in it
+	if (p1D && p1D->pPixels)
+	{
+		if (iSame != iRoom)
+			copy_room( p1D, 0, iSame * ROOM1C_H_PX, 0, iRoom * ROOM1C_H_PX );
+		else
+			draw_room( pDecoder, p1D, iRoom, 0, iRoom * ROOM1C_H_PX, NULL );
+	}
+}
+
+// ========================================
+void draw_world_room (Decoder_t *pDecoder, const int iRoom, uint32_t *pHistogram)
+{
+	if (!pDecoder->options.bQuiet)
+		printf( "Drawing room #%d\n", iRoom );
+
+	if (pDecoder->options.bIndexed)
+		draw_world_room( pDecoder, &pDecoder->indexMap2D, &pDecoder->indexMap1D, iRoom, pHistogram );
+	else
+	{
+		if (pDecoder->worldMap2D.pPixels)
+			draw_world_room( pDecoder, &pDecoder->worldMap2D, &pDecoder->worldMap1D, iRoom, pHistogram );
+
+		// NOTE: Only count tiles once if both RGBA and BGRA maps are rendered (-mmap)
+		if (pDecoder->bitmap2D.pPixels)
+			draw_world_room( pDecoder, &pDecoder->bitmap2D, (SurfaceBGRA_t*) NULL, iRoom, pDecoder->worldMap2D.pPixels ? NULL : pHistogram );
+	}
+}
+
+// Index the rooms by World Map cell so a region only visits the rooms it overlaps
+// ========================================
+void index_rooms (Decoder_t *pDecoder)
+{
+	const int nCells = pDecoder->world.nMapWidth * pDecoder->world.nMapHeight;
+
+	delete [] pDecoder->aRoomIndex;
+	pDecoder->aRoomIndex = new int[ nCells ];
+	for (int iCell = 0; iCell < nCells; ++iCell)
+		pDecoder->aRoomIndex[ iCell ] = -1;
+
+	for (int iRoom = 0; iRoom < pDecoder->world.nRooms; ++iRoom)
+	{
+		int nRoomX = pDecoder->aRooms[ iRoom ].nRoomX - pDecoder->world.nMinRoomX;
+		int nRoomY = pDecoder->aRooms[ iRoom ].nRoomY - pDecoder->world.nMinRoomY;
+		pDecoder->aRoomIndex[ nRoomY*pDecoder->world.nMapWidth + nRoomX ] = iRoom; // same as draw order: last room wins
+	}
+}
+
+// Rasterize one status line per distinct room title before rendering; drawing a label is then only row copies.
+// Titles are matched by content: a baked world has a copy of the title per room.
+// ========================================
+void make_labels (Decoder_t *pDecoder)
+{
+	const int nRooms = pDecoder->world.nRooms;
+	Labels_t &labels = pDecoder->labels;
+	free_labels( &labels );
+
+	int nBuckets = 16;
+	while (nBuckets < 2*nRooms)
+		nBuckets *= 2;
+
+	int         *aBucket = new int[ nBuckets ](); // label + 1, 0 = empty
+	const char **aText   = new const char*[ nRooms ];
+
+	for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+	{
+		const char *pText   = pDecoder->aRooms[ iRoom ].pRoomDesc->pDesc;
+		int         iBucket = (int)(hash_bytes( pText, strlen( pText ) ) & (nBuckets - 1));
+
+		while (aBucket[ iBucket ] && (strcmp( aText[ aBucket[ iBucket ] - 1 ], pText ) != 0))
+			iBucket = (iBucket + 1) & (nBuckets - 1);
+
+		if (!aBucket[ iBucket ])
+		{
+			aText[ labels.nLabels ] = pText;
+			aBucket[ iBucket ] = ++labels.nLabels;
+		}
+		pDecoder->aRooms[ iRoom ].iLabel = aBucket[ iBucket ] - 1;
+	}
+
+	labels.aRGBA    = new uint32_t[ (size_t) labels.nLabels * CGA_LABEL_Z ];
+	labels.aIndexed = new uint8_t [ (size_t) labels.nLabels * CGA_LABEL_Z ];
+	for (int iLabel = 0; iLabel < labels.nLabels; ++iLabel)
+		rasterize_label( labels.aRGBA + iLabel * CGA_LABEL_Z, labels.aIndexed + iLabel * CGA_LABEL_Z, aText[ iLabel ] );
+
+	delete [] aBucket;
+	delete [] aText;
+}
+
+// Rooms with exactly the same tiles as a lower numbered room, by rolling hash of the whole room, then compared
+// ========================================
+void dedup_rooms (Decoder_t *pDecoder)
+{
+	const int nRooms = pDecoder->world.nRooms;
+
+	delete [] pDecoder->aRoomDedup;
+	pDecoder->aRoomDedup = new int[ nRooms ];
+
+	int nBuckets = 16;
+	while (nBuckets < 2*nRooms)
+		nBuckets *= 2;
+
+	int *aBucket     = new int[ nBuckets ](); // room + 1, 0 = empty
+	int  nDuplicates = 0;
+
+	for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+	{
+		const Room_t *pRoom = &pDecoder->aRooms[ iRoom ];
+		pDecoder->aRoomDedup[ iRoom ] = iRoom;
+		if (pRoom->nRoomSize != ROOM1C_Z) // not drawn
+			continue;
+
+		int iBucket = (int)(roll_hash( pRoom->pRoomData, ROOM1C_Z, 1 ) & (nBuckets - 1));
+		while (aBucket[ iBucket ] && (memcmp( pDecoder->aRooms[ aBucket[ iBucket ] - 1 ].pRoomData, pRoom->pRoomData, sizeof(int16_t) * ROOM1C_Z ) != 0))
+			iBucket = (iBucket + 1) & (nBuckets - 1);
+
+		if (!aBucket[ iBucket ])
+			aBucket[ iBucket ] = iRoom + 1;
+		pDecoder->aRoomDedup[ iRoom ] = aBucket[ iBucket ] - 1;
+		if (pDecoder->aRoomDedup[ iRoom ] != iRoom)
+			nDuplicates++;
+	}
+
+	if (nDuplicates && !pDecoder->options.bQuiet)
+		printf( "Duplicate rooms: %d, drawn as copies\n", nDuplicates );
+	delete [] aBucket;
+}
+
+// Draw the part [nX0,nX1) x [nY0,nY1) of a 2D room, in room pixels, with room pixel (0,0) at pDst.
+// Tiles and label glyphs are clipped per 8 px tile row, nothing outside the rectangle is touched.
+// ========================================
+template<typename Surface>
+void draw_room_2D_clipped (const Decoder_t *pDecoder, const Surface *pSurface, typename Surface::Pixel *pDst, const int iRoom, const int nX0, const int nY0, const int nX1, const int nY1)
+{
+	typedef typename Surface::Pixel Pixel;
+
+	const int nPitch = pSurface->nPitch;
+
+	if (nY0 < ROOM1C_H_PX)
+	{
+		RoomTiles_t tiles;
+		if (!prepare_room( pDecoder, &tiles, iRoom, NULL ))
+			return;
+
+		const int nTilesY1 = (nY1 < ROOM1C_H_PX) ? nY1 : ROOM1C_H_PX;
+		for (int y = nY0; y < nTilesY1; ++y)
+		{
+			const Pixel *pAtlas  = get_atlas( pDecoder, pSurface ) + (y % TILE_H)*ATLAS_IMAGE_W;
+			const int   *pOffset = tiles.aOffset[ y / TILE_H ];
+
+			for (int x = nX0; x < nX1; )
+			{
+				const int iTile = x / TILE_W;
+				const int nSpan = ((iTile + 1)*TILE_W < nX1 ? (iTile + 1)*TILE_W : nX1) - x;
+
+				if (pOffset[ iTile ] >= 0)
+					memcpy( pDst + y*nPitch + x, pAtlas + pOffset[ iTile ] + (x % TILE_W), nSpan * sizeof(Pixel) );
+				x += nSpan;
+			}
+		}
+	}
+
+	// Status line: the clipped rows of the room's cached label, see draw_label()
+	const int nTextY = ROOM2D_H_PX - CGA_TILE_H;
+	if (nY1 > nTextY)
+	{
+		const Pixel *pLabel = get_label( pDecoder, pSurface, iRoom );
+
+		for (int y = (nY0 > nTextY) ? nY0 : nTextY; y < nY1; ++y)
+			memcpy( pDst + y*nPitch + nX0, pLabel + (y - nTextY)*CGA_LABEL_W + nX0, (nX1 - nX0) * sizeof(Pixel) );
+	}
+}
+
+// Render the nWidth x nHeight px rectangle of the 2D World Map at nWorldX, nWorldY into the top-left of pTarget.
+// Only the rooms the rectangle overlaps are visited (see index_rooms()), and only their overlapping
+// tiles and glyphs are drawn. Empty cells and anything outside the World Map are left transparent.
+// Reentrant: reads the rooms, atlas and font, writes nothing but pTarget.
+// ========================================
+template<typename Surface>
+bool render_region (const Decoder_t *pDecoder, const int nWorldX, const int nWorldY, const int nWidth, const int nHeight, Surface *pTarget)
+{
+	typedef typename Surface::Pixel Pixel;
+
+	if (!pDecoder->aRoomIndex || (nWidth > pTarget->nWidth) || (nHeight > pTarget->nHeight))
+		return false;
+
+	const Pixel nEmpty = (sizeof(Pixel) == 1) ? INDEX_TRANSPARENT : 0;
+	for (int y = 0; y < nHeight; ++y)
+	{
+		Pixel *pRow = pTarget->pPixels + y*pTarget->nPitch;
+		for (int x = 0; x < nWidth; ++x)
+			pRow[ x ] = nEmpty;
+	}
+
+	const int nWorldW = pDecoder->world.nMapWidth  * ROOM2D_W_PX;
+	const int nWorldH = pDecoder->world.nMapHeight * ROOM2D_H_PX;
+
+	// Clip to the World Map
+	const int x0 = (nWorldX > 0) ? nWorldX : 0, x1 = (nWorldX + nWidth  < nWorldW) ? nWorldX + nWidth  : nWorldW;
+	const int y0 = (nWorldY > 0) ? nWorldY : 0, y1 = (nWorldY + nHeight < nWorldH) ? nWorldY + nHeight : nWorldH;
+	if ((x0 >= x1) || (y0 >= y1))
+		return true;
+
+	for (int nCellY = y0 / ROOM2D_H_PX; nCellY <= (y1 - 1) / ROOM2D_H_PX; ++nCellY)
+	{
+		for (int nCellX = x0 / ROOM2D_W_PX; nCellX <= (x1 - 1) / ROOM2D_W_PX; ++nCellX)
+		{
+			const int iRoom = pDecoder->aRoomIndex[ nCellY*pDecoder->world.nMapWidth + nCellX ];
+			if (iRoom < 0)
+				continue;
+
+			// Room rectangle in world px, clipped, then made room relative
+			const int nRoomX = nCellX * ROOM2D_W_PX;
+			const int nRoomY = nCellY * ROOM2D_H_PX;
+			const int rx0 = ((x0 > nRoomX) ? x0 : nRoomX) - nRoomX, rx1 = ((x1 < nRoomX + ROOM2D_W_PX) ? x1 : nRoomX + ROOM2D_W_PX) - nRoomX;
+			const int ry0 = ((y0 > nRoomY) ? y0 : nRoomY) - nRoomY, ry1 = ((y1 < nRoomY + ROOM2D_H_PX) ? y1 : nRoomY + ROOM2D_H_PX) - nRoomY;
+
+			// Target pixel of room pixel (0,0), may be outside the target: only [rx0,rx1) x [ry0,ry1) is written
+			Pixel *pRoom = pTarget->pPixels + (ptrdiff_t)(nRoomY - nWorldY)*pTarget->nPitch + (nRoomX - nWorldX);
+			draw_room_2D_clipped( pDecoder, pTarget, pRoom, iRoom, rx0, ry0, rx1, ry1 );
+		}
+	}
+
+	return true;
+}
+
+// Same as render_region() in World Map cells, e.g. a single room is nRoomsW = nRoomsH = 1
+// ========================================
+template<typename Surface>
+bool render_room_region (const Decoder_t *pDecoder, const int nCellX, const int nCellY, const int nRoomsW, const int nRoomsH, Surface *pTarget)
+{
+	return render_region( pDecoder, nCellX * ROOM2D_W_PX, nCellY * ROOM2D_H_PX, nRoomsW * ROOM2D_W_PX, nRoomsH * ROOM2D_H_PX, pTarget );
+}
+
+// render_region() into caller memory, see decode.h
+// ========================================
+template<typename Format>
+bool render_region (const Decoder_t *pDecoder, const int nWorldX, const int nWorldY, const int nWidth, const int nHeight, typename Format::Pixel *pPixels, const int nPitch)
+{
+	if (!pPixels || (nWidth <= 0) || (nHeight <= 0) || (nPitch < nWidth))
+		return false;
+
+	Surface_t<Format> target;
+	map_surface( &target, (uint8_t*) pPixels, 1, 1, nWidth, nHeight, false );
+	target.nPitch = nPitch;
+	return render_region( pDecoder, nWorldX, nWorldY, nWidth, nHeight, &target );
+}
+
+// ========================================
+bool render_region (const Decoder_t *pDecoder, const int nWorldX, const int nWorldY, const int nWidth, const int nHeight, uint32_t *pPixels, const int nPitch)
+{
+	return render_region<RGBA_t>( pDecoder, nWorldX, nWorldY, nWidth, nHeight, pPixels, nPitch );
+}
+
+// ========================================
+bool render_region (const Decoder_t *pDecoder, const int nWorldX, const int nWorldY, const int nWidth, const int nHeight, uint8_t *pPixels, const int nPitch)
+{
+	return render_region<Index8_t>( pDecoder, nWorldX, nWorldY, nWidth, nHeight, pPixels, nPitch );
+}
+
+// -region: render a rectangle of the 2D World Map on its own and write it as raw 32-bit RGBA
+// ========================================
+void write_region (Decoder_t *pDecoder, const int nWorldX, const int nWorldY, const int nWidth, const int nHeight)
+{
+	if ((nWidth <= 0) || (nHeight <= 0))
+	{
+		printf( "ERROR: Region %d x %d px is empty\n", nWidth, nHeight );
+		return;
+	}
+
+	Surface32_t region;
+	alloc_surface( &region, 1, 1, nWidth, nHeight );
+
+	auto   tStart = std::chrono::steady_clock::now();
+	render_region( pDecoder, nWorldX, nWorldY, nWidth, nHeight, region.pPixels, region.nPitch );
+	auto   tEnd   = std::chrono::steady_clock::now();
+	double nUsecs = std::chrono::duration<double>( tEnd - tStart ).count() * 1e6;
+
+	printf( "Region %d x %d px at (%d,%d): %.1f us\n", nWidth, nHeight, nWorldX, nWorldY, nUsecs );
+
+	char sFileName[ MAX_FILE_NAME ];
+	sprintf( sFileName, "%sWorldMap2D_region_%d_%d_rgba32_%dx%d.data", pDecoder->sOutputDir, nWorldX, nWorldY, nWidth, nHeight );
+	save_file( pDecoder, sFileName, region.pPixels, region.nSize );
+
+	free_surface( &region );
+
+	end_stage( pDecoder, "write_region" );
+	write_metrics( pDecoder );
+}
+
+// -mmap: size each output file, map it, and point the World Maps at its pixels.
+// The raw .data maps are RGBA, the .BMP is BGRA bottom-up after its header.
+// ========================================
+void map_outputs (Decoder_t *pDecoder, const int nRooms)
+{
+	const int nMapW  = pDecoder->world.nMapWidth;
+	const int nMapH  = pDecoder->world.nMapHeight;
+	const int nWidth = nMapW * ROOM2D_W_PX;
+	const int nHeight= nMapH * ROOM2D_H_PX;
+
+	if (pDecoder->options.bRawData)
+	{
+		if (pDecoder->options.bRender1D)
+		{
+			OutputFile_t &out = pDecoder->output1D;
+			sprintf( out.sFileName, "%sWorldMap1D_%dx%d_rooms_rgba32_%dx%d.data", pDecoder->sOutputDir, 1, nRooms, ROOM1C_W_PX, nRooms*ROOM1C_H_PX );
+			if (map_output_file( out.sFileName, 4 * (size_t)ROOM1C_W_PX * ROOM1C_H_PX * nRooms, &out.view ))
+				map_surface( &pDecoder->worldMap1D, out.view.pData, 1, nRooms, ROOM1C_W_PX, ROOM1C_H_PX, false );
+		}
+
+		OutputFile_t &out = pDecoder->output2D;
+		sprintf( out.sFileName, "%sWorldMap2D_%dx%d_rooms_rgba32_%dx%d.data", pDecoder->sOutputDir, nMapW, nMapH, nWidth, nHeight );
+		if (map_output_file( out.sFileName, 4 * (size_t)nWidth * nHeight, &out.view ))
+			map_surface( &pDecoder->worldMap2D, out.view.pData, nMapW, nMapH, ROOM2D_W_PX, ROOM2D_H_PX, false );
+	}
+
+	OutputFile_t &out = pDecoder->outputBMP;
+	sprintf( out.sFileName, "%sWorldMap2D_%dx%d_rooms.bmp", pDecoder->sOutputDir, nMapW, nMapH );
+	if (map_output_file( out.sFileName, BMP_HEADER_SIZE + 4 * (size_t)nWidth * nHeight, &out.view ))
+	{
+		make_bitmap_header( out.view.pData, nWidth, nHeight );
+		map_surface( &pDecoder->bitmap2D, out.view.pData + BMP_HEADER_SIZE, nMapW, nMapH, ROOM2D_W_PX, ROOM2D_H_PX, true );
+	}
+}
+
+// -mmap: the World Maps were rendered into the files, unmapping is all that is left to do
+// ========================================
+void unmap_outputs (Decoder_t *pDecoder)
+{
+	OutputFile_t *aOutput[3] = { &pDecoder->output1D, &pDecoder->output2D, &pDecoder->outputBMP };
+
+	for (int iOutput = 0; iOutput < 3; ++iOutput)
+	{
+		OutputFile_t *pOut = aOutput[ iOutput ];
+		if (!pOut->view.pData)
+			continue;
+
+		pDecoder->metrics.nBytesWritten += pOut->view.nSize;
+		unmap_file( &pOut->view );
+		if (!pDecoder->options.bQuiet)
+			printf( "Saved: %s\n", pOut->sFileName );
+	}
+
+	// Surfaces don't own the mapped pixels
+	memset( &pDecoder->worldMap1D, 0, sizeof(pDecoder->worldMap1D) );
+	memset( &pDecoder->worldMap2D, 0, sizeof(pDecoder->worldMap2D) );
+	memset( &pDecoder->bitmap2D  , 0, sizeof(pDecoder->bitmap2D  ) );
+}
+
+// ========================================
+void draw_rooms (Decoder_t *pDecoder, int nRooms)
+{
+	memset(pDecoder->aHistogram , 0, sizeof(pDecoder->aHistogram) );
+
+	// Surfaces are sized from the actual world, allocated zeroed
+	free_surface( &pDecoder->worldMap1D );
+	free_surface( &pDecoder->worldMap2D );
+	free_surface( &pDecoder->indexMap1D );
+	free_surface( &pDecoder->indexMap2D );
+	free_surface( &pDecoder->bitmap2D   );
+	if (pDecoder->options.bMapOutput)
+		map_outputs( pDecoder, nRooms );
+	else
+	if (pDecoder->options.bIndexed)
+	{
+		if (pDecoder->options.bRender1D)
+			alloc_surface( &pDecoder->indexMap1D, 1, nRooms, ROOM1C_W_PX, ROOM1C_H_PX, INDEX_TRANSPARENT );
+		alloc_surface( &pDecoder->indexMap2D, pDecoder->world.nMapWidth, pDecoder->world.nMapHeight, ROOM2D_W_PX, ROOM2D_H_PX, INDEX_TRANSPARENT );
+	}
+	else
+	if (pDecoder->options.bRawData)
+	{
+		if (pDecoder->options.bRender1D)
+			alloc_surface( &pDecoder->worldMap1D, 1, nRooms, ROOM1C_W_PX, ROOM1C_H_PX );
+		alloc_surface( &pDecoder->worldMap2D, pDecoder->world.nMapWidth, pDecoder->world.nMapHeight, ROOM2D_W_PX, ROOM2D_H_PX );
+	}
+	else // Only the .BMP is wanted so render directly in its byte order
+		alloc_surface( &pDecoder->bitmap2D  , pDecoder->world.nMapWidth, pDecoder->world.nMapHeight, ROOM2D_W_PX, ROOM2D_H_PX );
+
+	if (!pDecoder->options.bQuiet)
+	{
+		printf( "World size: %d x %d rooms\n", pDecoder->world.nMapWidth, pDecoder->world.nMapHeight );
+		printf( "   Left : %+3d, Top: %+3d\n", pDecoder->world.nMinRoomX, pDecoder->world.nMinRoomY );
+		printf( "   Right: %+3d, Bot: %+3d\n", pDecoder->world.nMaxRoomX, pDecoder->world.nMaxRoomY );
+	}
+
+	int nThreads = get_thread_count( pDecoder );
+	if (nThreads > nRooms) nThreads = nRooms;
+
+	// A duplicate always has a higher number than the room it copies, see dedup_rooms()
+	if (nThreads <= 1)
+	{
+		for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+			draw_world_room( pDecoder, iRoom, pDecoder->aHistogram );
+		return;
+	}
+
+	// Every room writes a disjoint region of each World Map so rooms can be drawn in any order:
+	// a room hidden by a later room in the same cell skips the 2D World Map, see draw_world_room().
+	// Every worker counts tiles in a private histogram which is merged afterwards.
+	// Duplicate rooms copy finished rooms so they are drawn in a second pass.
+	if (!pDecoder->options.bQuiet)
+		printf( "Rendering on %d threads\n", nThreads );
+
+	int *aOrder  = new int[ nRooms ];
+	int  nUnique = 0;
+	for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+		if (!pDecoder->aRoomDedup || (pDecoder->aRoomDedup[ iRoom ] == iRoom))
+			aOrder[ nUnique++ ] = iRoom;
+	for (int iRoom = 0, iOrder = nUnique; iRoom < nRooms; ++iRoom)
+		if (pDecoder->aRoomDedup && (pDecoder->aRoomDedup[ iRoom ] != iRoom))
+			aOrder[ iOrder++ ] = iRoom;
+
+	uint32_t *aHistogram = new uint32_t[ nThreads * HISTOGRAM_SIZE ](); // () = zero initialize
+
+	for (int iPass = 0; iPass < 2; ++iPass)
+	{
+		const int *pOrder = aOrder + (iPass ? nUnique : 0);
+		run_workers( nThreads, iPass ? nRooms - nUnique : nUnique, [pDecoder, pOrder, aHistogram]( const int iOrder, const int iWorker )
+		{
+			draw_world_room( pDecoder, pOrder[ iOrder ], aHistogram + iWorker*HISTOGRAM_SIZE );
+		});
+	}
+
+	for (int iThread = 0; iThread < nThreads; ++iThread)
+	{
+		uint32_t *pHistogram = aHistogram + iThread*HISTOGRAM_SIZE;
+		for (int iTile = 0; iTile < HISTOGRAM_SIZE; ++iTile)
+			pDecoder->aHistogram[ iTile ] += pHistogram[ iTile ];
+	}
+
+	delete [] aHistogram;
+	delete [] aOrder;
+}
+
+// Returns the pixel offset of a map tile in the texture atlas, or -1 if it isn't in the atlas
+// ========================================
+int get_tile_offset (const int16_t iTile, const int iDstX, const int iDstY)
+{
+	int iSrcTileX = (iTile >> 0) & 0xFF;
+	int iSrcTileY = (iTile >> 8) & 0xFF;
+
+#ifndef TUTORIAL
+	// Never should have an invalid atlas tile
+	if ((iSrcTileX >= ATLAS_W) || (iSrcTileY >= ATLAS_H))
+	{
+		printf( "ERROR: Invalid map tile! 0x%04X, DstX: %d, DstY: %d\n", iTile, iDstX, iDstY );
+		return -1;
+	}
+#endif
+
+	iSrcTileX &= (ATLAS_W - 1);
+	iSrcTileY &= (ATLAS_H - 1);
+
+	return (iSrcTileY * TILE_H * ATLAS_IMAGE_W) + (iSrcTileX * TILE_W);
+}
+
+// Copy from 2D 8x8 @ 32bbp gTilesRGBA[] or gTilesBGRA[] to any 32bpp surface at iDstX, iDstY px
+// ========================================
+template<typename Format>
+void draw_tile (const Decoder_t *pDecoder, Surface_t<Format> *pSurface, const int16_t iTile, const int iDstX, const int iDstY)
+{
+	int offset = get_tile_offset( iTile, iDstX, iDstY );
+	if (offset < 0)
+		return;
+
+	const uint32_t *src = get_atlas( pDecoder, pSurface ) + offset;
+	uint32_t       *dst = pSurface->pPixels + (iDstY * pSurface->nPitch) + iDstX;
+
+	gBlitter.pBlit8x8( dst, pSurface->nPitch, src, ATLAS_IMAGE_W );
+}
+
+// Copy from 2D 8x8 @ 8bpp gTilesIndexed[] to any 8bpp surface at iDstX, iDstY px
+// ========================================
+void draw_tile (const Decoder_t *pDecoder, Surface8_t *pSurface, const int16_t iTile, const int iDstX, const int iDstY)
+{
+	int offset = get_tile_offset( iTile, iDstX, iDstY );
+	if (offset < 0)
+		return;
+
+	const uint8_t *src = get_atlas( pDecoder, pSurface ) + offset;
+	uint8_t       *dst = pSurface->pPixels + (iDstY * pSurface->nPitch) + iDstX;
+
+	blit_8x8_indexed( dst, pSurface->nPitch, src, ATLAS_IMAGE_W );
+}
+
+// Tile = 0xYYXX -> dense index YY*ATLAS_W + XX in [0,NUM_TILE), -1 if the tile isn't in the texture atlas
+// ========================================
+int get_tile_index (const int16_t iTile)
+{
+	const int iTileX = (iTile >> 0) & 0xFF;
+	const int iTileY = (iTile >> 8) & 0xFF;
+
+	if ((iTileX >= ATLAS_W) || (iTileY >= ATLAS_H))
+		return -1;
+
+	return iTileY*ATLAS_W + iTileX;
+}
+
+// Dense index -> Tile = 0xYYXX
+// ========================================
+int get_tile_id (const int iIndex)
+{
+	return ((iIndex / ATLAS_W) << 8) | (iIndex % ATLAS_W);
+}
+
+// ========================================
+int count_used_tiles (const Decoder_t *pDecoder)
+{
+	int used_tiles = 0;
+	for (int i = 0; i < NUM_TILE; ++i)
+		if (pDecoder->aHistogram[i])
+			used_tiles++;
+	return used_tiles;
+}
+
+// ========================================
+void dump_histogram (const Decoder_t *pDecoder)
+{
+	if (!pDecoder->options.bQuiet)
+	{
+		printf( "Histogram Map Tiles (Tile = 0xYYXX)\n" );
+
+		for (int i = 0; i < NUM_TILE; ++i)
+		{
+			printf( "%04X: %6d  ", get_tile_id( i ), pDecoder->aHistogram[i] );
+
+			if ((i & 0xF) == 0xF)
+				printf( "\n" );
+		}
+	}
+
+	int used_tiles = count_used_tiles( pDecoder ); // yyxx
+
+	printf( "Used   tiles: %d\n", used_tiles );
+	printf( "Unused tiles: %d\n", NUM_TILE - used_tiles );
+	printf( "Total  tiles: %d\n", NUM_TILE );
+	printf( "Efficiency: %5.2f%%\n", 100.0 * (double)used_tiles / (double)NUM_TILE );
+}
+
+// Map the raw binary map; rooms are decoded in place, no copy
+// ========================================
+bool read_map (Decoder_t *pDecoder)
+{
+	if (!map_file( pDecoder->pMapFile, &pDecoder->map ))
+		return false;
+
+	pDecoder->metrics.nBytesRead += pDecoder->map.nSize; // the whole file is decoded in place
+	return true;
+}
+
+// Read texture atlas, shared by every decoder: only called once, see load_assets()
+// ========================================
+void read_tiles8bpp (Decoder_t *pDecoder)
+{
+	// Note: Source file is `tiles.bmp` but we read a raw image exported with GIMP so we don't need .BMP reading code
+	nTilesRawIndex = read_file( ATLAS_FILENAME, gTilesRawIndex, 192*K );
+	pDecoder->metrics.nBytesRead += nTilesRawIndex;
+}
+
+// ========================================
+void write_surface_rgba32 (Decoder_t *pDecoder, const char* pFilename, const Surface32_t &map)
+{
+	save_file( pDecoder, pFilename, map.pPixels, map.nSize );
+}
+
+// Expand palette indices to 32-bpp one scanline at a time, no full size 32-bpp copy
+// ========================================
+void write_surface_rgba32 (Decoder_t *pDecoder, const char* pFilename, const Surface8_t &map)
+{
+	FILE *out = fopen( pFilename, "w+b");
+	if (!out)
+	{
+		printf( "ERROR: Couldn't write: '%s'\n", pFilename );
+		return;
+	}
+
+	uint32_t *pRow  = new uint32_t[ map.nWidth ];
+	size_t    wrote = 0;
+
+	for (int y = 0; y < map.nHeight; ++y)
+	{
+		expand_row<RGBA_t>( pRow, map.pPixels + y*map.nPitch, map.nWidth );
+		wrote += fwrite( pRow, 4, map.nWidth, out ) * 4;
+	}
+
+	fclose( out );
+	delete [] pRow;
+	pDecoder->metrics.nBytesWritten += wrote;
+
+	if (wrote == 4 * (size_t)map.nWidth * map.nHeight)
+	{
+		if (!pDecoder->options.bQuiet)
+			printf( "Saved: %s\n", pFilename );
+	}
+	else
+		printf( "ERROR: Only wrote %d bytes!\n", (int) wrote );
+}
+
+// Writes a World Map to a raw 1:1 image file
+// ========================================
+template<typename Surface>
+void write_map_rgba32 (Decoder_t *pDecoder, const char *pName, const Surface &map)
+{
+	printf( "Native 1:1 World Map %s (raw 32-bit RGBA)\n", pName );
+	printf( "  Image Dimensions: %d x %d px\n", map.nWidth, map.nHeight );
+	printf( "  Rooms: %d x %d\n", map.nRoomsW, map.nRoomsH );
+	printf( "\n" );
+
+	char sFileName[ MAX_FILE_NAME ];
+	sprintf( sFileName, "%sWorldMap%s_%dx%d_rooms_rgba32_%dx%d.data", pDecoder->sOutputDir, pName, map.nRoomsW, map.nRoomsH, map.nWidth, map.nHeight );
+	write_surface_rgba32( pDecoder, sFileName, map );
+}
+
+// Writes the one column Map to a raw 1:1 image file
+// ========================================
+void write_map1C_rgba32 (Decoder_t *pDecoder)
+{
+	if (pDecoder->options.bIndexed)
+		write_map_rgba32( pDecoder, "1D", pDecoder->indexMap1D );
+	else
+		write_map_rgba32( pDecoder, "1D", pDecoder->worldMap1D );
+}
+
+// ========================================
+void write_map2D_rgba32 (Decoder_t *pDecoder)
+{
+	if (pDecoder->options.bIndexed)
+		write_map_rgba32( pDecoder, "2D", pDecoder->indexMap2D );
+	else
+		write_map_rgba32( pDecoder, "2D", pDecoder->worldMap2D );
+}
+
+// Copy scanline y of a RGBA surface to a .BMP scanline
+// ========================================
+void copy_bitmap_row (uint8_t *pDst, const Surface32_t &map, const int y)
+{
+	memcpy( pDst, map.pPixels + y*map.nPitch, map.nWidth*4 ); // 4 = RGBA channels
+
+	// Stupid Windows .BMP need to swizzle ABGR -> ARGB otherwise we could do a simple scanline copy
+	for (int x = 0; x < map.nWidth; ++x)
+	{
+		uint8_t red  = pDst[0];
+		uint8_t blue = pDst[2];
+		               pDst[2] = red;
+		               pDst[0] = blue;
+		pDst   += 4;
+	}
+}
+
+// BGRA surfaces are already in .BMP byte order: plain scanline copy
+// ========================================
+void copy_bitmap_row (uint8_t *pDst, const SurfaceBGRA_t &map, const int y)
+{
+	memcpy( pDst, map.pPixels + y*map.nPitch, map.nWidth*4 ); // 4 = BGRA channels
+}
+
+// Indexed scanlines expand straight to BGRA with the pre-swizzled palette, no swizzle pass
+// ========================================
+void copy_bitmap_row (uint8_t *pDst, const Surface8_t &map, const int y)
+{
+	expand_row<BGRA_t>( (uint32_t*) pDst, map.pPixels + y*map.nPitch, map.nWidth );
+}
+
+// Bytes per .BMP scanline, rows are padded to a multiple of 4 bytes
+// ========================================
+uint32_t get_bitmap_pitch (const int nWidth, const int nBits)
+{
+	return (((uint32_t)nWidth * nBits + 31) / 32) * 4;
+}
+
+// Offset of the pixels: header, plus the color table for 8 and 4-bpp
+// ========================================
+uint32_t get_bitmap_offset (const int nBits)
+{
+	return BMP_HEADER_SIZE + ((nBits <= 8) ? 4*BMP_PALETTE_SIZE : 0);
+}
+
+// Fill in a 32, 8 or 4-bpp Windows .BMP header (and color table), returns total file size
+// ========================================
+uint32_t make_bitmap_header (uint8_t *pHeader, const int nWidth, const int nHeight, const int nBits)
+{
+	const uint32_t nImageSize = get_bitmap_pitch( nWidth, nBits ) * nHeight;
+	const uint32_t nOffset    = get_bitmap_offset( nBits );
+
+	uint32_t aHeader[13]; // Windows .BMP header, "BM" + 13*int32 = 54 bytes
+	int      nPlanes   = 1;
+	int      nBitcount = nBits << 16; // nBitCount and nPlanes are 16-bit in the header but we pack them together
+
+	// Header: Note that the "BM" identifier in bytes 0 and 1 is NOT included in this header but IS written to the file
+	aHeader[ 0] = nOffset + nImageSize;         // bfSize (total file size)
+	aHeader[ 1] = 0;                            // bfReserved1 bfReserved2
+	aHeader[ 2] = nOffset;                      // bfOffbits
+	aHeader[ 3] = 40;                           // biSize BITMAPHEADER
+	aHeader[ 4] = nWidth;                       // biWidth
+	aHeader[ 5] = nHeight;                      // biHeight
+	aHeader[ 6] = nBitcount | nPlanes;          // biPlanes, biBitcount
+	aHeader[ 7] = 0;                            // biCompression
+	aHeader[ 8] = nImageSize;                   // biSizeImage
+	aHeader[ 9] = 0;                            // biXPelsPerMeter
+	aHeader[10] = 0;                            // biYPelsPerMeter
+	aHeader[11] = (nBits <= 8) ? BMP_PALETTE_SIZE : 0; // biClrUsed
+	aHeader[12] = 0;                            // biClrImportant
+
+	pHeader[0] = 'B';
+	pHeader[1] = 'M';
+	memcpy( pHeader+2, &aHeader[0], BMP_HEADER_SIZE-2 );
+
+	// Color table entries are B,G,R,0 -- the BGRA palette with alpha cleared
+	if (nBits <= 8)
+		for (int iColor = 0; iColor < BMP_PALETTE_SIZE; ++iColor)
+		{
+			uint32_t bgr0 = Palette_t<BGRA_t>::aColor[ iColor ] & 0x00FFFFFF;
+			memcpy( pHeader + BMP_HEADER_SIZE + 4*iColor, &bgr0, 4 );
+		}
+
+	return aHeader[0];
+}
+
+// Pack palette indices into an 8 or 4-bpp .BMP scanline.
+// NOTE: .BMP has no transparency, INDEX_TRANSPARENT & 0xF is palette black.
+// ========================================
+void pack_bitmap_row (uint8_t *pDst, const uint8_t *pSrc, const int nWidth, const int nBits)
+{
+	if (nBits == 8)
+	{
+		for (int x = 0; x < nWidth; ++x)
+			pDst[x] = pSrc[x] & 0xF;
+		return;
+	}
+
+	// 4-bpp: left pixel in the high nibble
+	for (int x = 0; x < nWidth; x += 2)
+	{
+		uint8_t right = (x+1 < nWidth) ? (pSrc[x+1] & 0xF) : 0;
+		pDst[x/2] = ((pSrc[x] & 0xF) << 4) | right;
+	}
+}
+
+// ========================================
+template<typename Surface>
+void write_bitmap (Decoder_t *pDecoder, const Surface &map)
+{
+	uint32_t nFileSize = BMP_HEADER_SIZE + 4 * map.nWidth * map.nHeight;
+	uint8_t *pBuffer   = new uint8_t [ nFileSize ];
+
+	make_bitmap_header( pBuffer, map.nWidth, map.nHeight );
+
+	// Stupid Windows .BMP are upside down so copy scanline by scanline
+	// Otherwise we could simply just write the entire map in one go
+	//     memcpy( pBuffer+BMP_HEADER_SIZE, map.pPixels, map.nSize );
+
+	uint8_t *pDst = pBuffer + BMP_HEADER_SIZE;
+
+	for (int y = map.nHeight - 1; y >= 0; --y) // start on bottom scanline, iterate to top
+	{
+		copy_bitmap_row( pDst, map, y );
+		pDst += map.nWidth*4;
+	}
+
+	char sFileName[ MAX_FILE_NAME ];
+	sprintf( sFileName, "%sWorldMap2D_%dx%d_rooms.bmp", pDecoder->sOutputDir, map.nRoomsW, map.nRoomsH );
+	save_file( pDecoder, sFileName, pBuffer, nFileSize );
+
+	delete [] pBuffer;
+}
+
+// 8 or 4-bpp .BMP straight from the palette indices, no 32-bpp expansion
+// ========================================
+void write_bitmap_indexed (Decoder_t *pDecoder, const Surface8_t &map, const int nBits)
+{
+	const uint32_t nPitch    = get_bitmap_pitch( map.nWidth, nBits );
+	const uint32_t nOffset   = get_bitmap_offset( nBits );
+	uint32_t       nFileSize = nOffset + nPitch * map.nHeight;
+	uint8_t       *pBuffer   = new uint8_t [ nFileSize ](); // () = zero the row padding
+
+	make_bitmap_header( pBuffer, map.nWidth, map.nHeight, nBits );
+
+	uint8_t *pDst = pBuffer + nOffset;
+
+	for (int y = map.nHeight - 1; y >= 0; --y) // start on bottom scanline, iterate to top
+	{
+		pack_bitmap_row( pDst, map.pPixels + y*map.nPitch, map.nWidth, nBits );
+		pDst += nPitch;
+	}
+
+	char sFileName[ MAX_FILE_NAME ];
+	sprintf( sFileName, "%sWorldMap2D_%dx%d_rooms.bmp", pDecoder->sOutputDir, map.nRoomsW, map.nRoomsH );
+	save_file( pDecoder, sFileName, pBuffer, nFileSize );
+
+	delete [] pBuffer;
+}
+
+// ========================================
+void write_map2D_bitmap (Decoder_t *pDecoder)
+{
+	if (pDecoder->options.bIndexed && (pDecoder->options.nBitmapBits <= 8))
+		write_bitmap_indexed( pDecoder, pDecoder->indexMap2D, pDecoder->options.nBitmapBits );
+	else
+	if (pDecoder->options.bIndexed)
+		write_bitmap( pDecoder, pDecoder->indexMap2D );
+	else
+	if (pDecoder->bitmap2D.pPixels)
+		write_bitmap( pDecoder, pDecoder->bitmap2D );
+	else
+		write_bitmap( pDecoder, pDecoder->worldMap2D );
+}
+
+
+// Write texture atlas 32 bpp, 256x256 px
+// ========================================
+void write_tiles32bpp (Decoder_t *pDecoder)
+{
+	char sFileName[ MAX_FILE_NAME ];
+	sprintf( sFileName, "%stiles_%dx%d_rgba32_%dx%d.data", pDecoder->sOutputDir, ATLAS_W, ATLAS_H, ATLAS_IMAGE_W, ATLAS_IMAGE_H );
+	save_file( pDecoder, sFileName, (void*) pDecoder->assets.pTilesRGBA, sizeof( gTilesRGBA ) );
+}
+
+// PNG ________________________________________________________________
+
+	// Deflate (RFC 1951) with LZ77 + fixed Huffman codes, no external library
+	const int DEFLATE_WINDOW    = 32768;
+	const int DEFLATE_HASH_BITS = 15;
+	const int DEFLATE_MIN_MATCH = 3;
+	const int DEFLATE_MAX_MATCH = 258;
+	const int DEFLATE_MAX_CHAIN = 32;     // hash chain links searched per position
+	const int PNG_STRIP_BYTES   = 1 << 20; // ~1 MB of scanlines per strip, deflated independently
+
+	uint32_t gCrc32Table  [256];
+	uint16_t gFixedLitCode[288]; // fixed Huffman literal/length codes, bit reversed for LSB first output
+	uint8_t  gFixedLitBits[288];
+	uint16_t gFixedDistCode[30];
+
+	const uint16_t gLengthBase [29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+	const uint8_t  gLengthExtra[29] = { 0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0 };
+	uint8_t        gLengthCode [DEFLATE_MAX_MATCH+1]; // match length -> gLengthBase[] index
+
+	// One horizontal strip of the image, deflated on its own and ended with a sync flush
+	struct PngStrip_t
+	{
+		int      nRowStart;
+		int      nRows;
+		uint8_t *pDeflate; // deflate bytes with room for the zlib header in front and Adler-32 behind
+		size_t   nDeflate;
+		uint32_t nAdler;   // of this strip's uncompressed bytes
+		size_t   nRaw;
+	};
+
+	// Deflate output is written LSB first
+	struct BitWriter_t
+	{
+		uint8_t *pOut;
+		uint64_t nBits;
+		int      nCount;
+	};
+
+	// ========================================
+	inline void put_bits (BitWriter_t *pWriter, const uint32_t nCode, const int nBits)
+	{
+		pWriter->nBits  |= (uint64_t)nCode << pWriter->nCount;
+		pWriter->nCount += nBits;
+		while (pWriter->nCount >= 8)
+		{
+			*pWriter->pOut++ = (uint8_t) pWriter->nBits;
+			pWriter->nBits >>= 8;
+			pWriter->nCount -= 8;
+		}
+	}
+
+	// ========================================
+	uint32_t reverse_bits (uint32_t nCode, const int nBits)
+	{
+		uint32_t nReversed = 0;
+		for (int iBit = 0; iBit < nBits; ++iBit, nCode >>= 1)
+			nReversed = (nReversed << 1) | (nCode & 1);
+		return nReversed;
+	}
+
+	// ========================================
+	void make_png_tables ()
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t crc = i;
+			for (int iBit = 0; iBit < 8; ++iBit)
+				crc = (crc & 1) ? 0xEDB88320 ^ (crc >> 1) : (crc >> 1);
+			gCrc32Table[ i ] = crc;
+		}
+
+		// RFC 1951 3.2.6
+		for (int iSym = 0; iSym < 288; ++iSym)
+		{
+			uint32_t nCode;
+			int      nBits;
+			if      (iSym < 144) { nCode = 0x030 + iSym        ; nBits = 8; }
+			else if (iSym < 256) { nCode = 0x190 + iSym -  144 ; nBits = 9; }
+			else if (iSym < 280) { nCode = 0x000 + iSym -  256 ; nBits = 7; }
+			else                 { nCode = 0x0C0 + iSym -  280 ; nBits = 8; }
+			gFixedLitCode[ iSym ] = (uint16_t) reverse_bits( nCode, nBits );
+			gFixedLitBits[ iSym ] = (uint8_t ) nBits;
+		}
+
+		for (int iDist = 0; iDist < 30; ++iDist)
+			gFixedDistCode[ iDist ] = (uint16_t) reverse_bits( iDist, 5 );
+
+		for (int iCode = 0; iCode < 29; ++iCode)
+		{
+			int nEnd = (iCode < 28) ? gLengthBase[ iCode+1 ] : DEFLATE_MAX_MATCH+1;
+			for (int nLen = gLengthBase[ iCode ]; nLen < nEnd; ++nLen)
+				gLengthCode[ nLen ] = (uint8_t) iCode;
+		}
+	}
+
+	// ========================================
+	uint32_t crc32_update (uint32_t crc, const uint8_t *pData, const size_t nSize)
+	{
+		crc = ~crc;
+		for (size_t i = 0; i < nSize; ++i)
+			crc = gCrc32Table[ (crc ^ pData[i]) & 0xFF ] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	const uint32_t ADLER_MOD = 65521;
+
+	// ========================================
+	uint32_t adler32_update (uint32_t adler, const uint8_t *pData, size_t nSize)
+	{
+		uint32_t a = adler & 0xFFFF;
+		uint32_t b = adler >> 16;
+
+		while (nSize)
+		{
+			size_t nBlock = (nSize < 5552) ? nSize : 5552; // largest block that can't overflow b
+			nSize -= nBlock;
+			while (nBlock--)
+			{
+				a += *pData++;
+				b += a;
+			}
+			a %= ADLER_MOD;
+			b %= ADLER_MOD;
+		}
+		return (b << 16) | a;
+	}
+
+	// Adler-32 of A followed by B, from the checksums of each (same math as zlib's adler32_combine)
+	// ========================================
+	uint32_t adler32_combine (const uint32_t adlerA, const uint32_t adlerB, const size_t nSizeB)
+	{
+		uint64_t rem  = nSizeB % ADLER_MOD;
+		uint64_t sum1 = adlerA & 0xFFFF;
+		uint64_t sum2 = (rem * sum1) % ADLER_MOD;
+
+		sum1 += (adlerB & 0xFFFF) + ADLER_MOD - 1;
+		sum2 += (adlerA >> 16) + (adlerB >> 16) + ADLER_MOD - rem;
+
+		return (uint32_t)(((sum2 % ADLER_MOD) << 16) | (sum1 % ADLER_MOD));
+	}
+
+	// Compress pData[ nDict .. nDict+nSize ) as one fixed Huffman block.
+	// The first nDict bytes are the previous strip's tail: only used as history for matches (pigz style).
+	// Non-final strips end with a sync flush so the strips can simply be concatenated.
+	// pOut must hold at least deflate_bound(nSize) bytes. Returns bytes written.
+	// ========================================
+	size_t deflate_block (uint8_t *pOut, const uint8_t *pData, const int nDict, const int nSize, const bool bFinal, int32_t *pHead, int32_t *pPrev)
+	{
+		const int HASH_SIZE = 1 << DEFLATE_HASH_BITS;
+		const int WMASK     = DEFLATE_WINDOW - 1;
+		const int nEnd      = nDict + nSize;
+
+		for (int i = 0; i < HASH_SIZE; ++i)
+			pHead[ i ] = -1;
+
+		BitWriter_t writer = { pOut, 0, 0 };
+		put_bits( &writer, bFinal ? 1 : 0, 1 ); // BFINAL
+		put_bits( &writer, 1, 2 );              // BTYPE = fixed Huffman
+
+		// Insert position i into the hash chains, needs 3 bytes
+		auto hash = [pData]( const int i ) -> uint32_t
+		{
+			uint32_t n = pData[i] | (pData[i+1] << 8) | (pData[i+2] << 16);
+			return (n * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+		};
+		auto insert = [&]( const int i )
+		{
+			if (i + DEFLATE_MIN_MATCH > nEnd)
+				return;
+			uint32_t h = hash( i );
+			pPrev[ i & WMASK ] = pHead[ h ];
+			pHead[ h ] = i;
+		};
+
+		for (int i = (nDict > DEFLATE_WINDOW) ? nDict - DEFLATE_WINDOW : 0; i < nDict; ++i)
+			insert( i );
+
+		int i = nDict;
+		while (i < nEnd)
+		{
+			int nBestLen  = 0;
+			int nBestDist = 0;
+			int nMaxLen   = nEnd - i;
+			if (nMaxLen > DEFLATE_MAX_MATCH)
+				nMaxLen = DEFLATE_MAX_MATCH;
+
+			if (nMaxLen >= DEFLATE_MIN_MATCH)
+			{
+				int iCand  = pHead[ hash( i ) ];
+				int nChain = DEFLATE_MAX_CHAIN;
+
+				while ((iCand >= 0) && (i - iCand < DEFLATE_WINDOW) && nChain--)
+				{
+					if (pData[ iCand + nBestLen ] == pData[ i + nBestLen ])
+					{
+						int nLen = 0;
+						while ((nLen < nMaxLen) && (pData[ iCand + nLen ] == pData[ i + nLen ]))
+							++nLen;
+
+						if (nLen > nBestLen)
+						{
+							nBestLen  = nLen;
+							nBestDist = i - iCand;
+							if (nLen == nMaxLen)
+								break;
+						}
+					}
+
+					int iNext = pPrev[ iCand & WMASK ];
+					if (iNext >= iCand) // slot was reused by a newer position
+						break;
+					iCand = iNext;
+				}
+			}
+
+			if (nBestLen >= DEFLATE_MIN_MATCH)
+			{
+				int iLen = gLengthCode[ nBestLen ];
+				put_bits( &writer, gFixedLitCode[ 257 + iLen ], gFixedLitBits[ 257 + iLen ] );
+				put_bits( &writer, nBestLen - gLengthBase[ iLen ], gLengthExtra[ iLen ] );
+
+				// Distance code: 2 codes per power of 2 above 4
+				int d = nBestDist - 1;
+				if (d < 4)
+					put_bits( &writer, gFixedDistCode[ d ], 5 );
+				else
+				{
+					int nExtra = 1;
+					while ((d >> (nExtra + 1)) > 1)
+						++nExtra;
+					int iDist = 2*(nExtra + 1) + ((d >> nExtra) & 1);
+					put_bits( &writer, gFixedDistCode[ iDist ], 5 );
+					put_bits( &writer, d & ((1 << nExtra) - 1), nExtra );
+				}
+
+				for (int n = 0; n < nBestLen; ++n)
+					insert( i + n );
+				i += nBestLen;
+			}
+			else
+			{
+				put_bits( &writer, gFixedLitCode[ pData[i] ], gFixedLitBits[ pData[i] ] );
+				insert( i );
+				++i;
+			}
+		}
+
+		put_bits( &writer, gFixedLitCode[ 256 ], gFixedLitBits[ 256 ] ); // end of block
+
+		if (!bFinal)
+		{
+			put_bits( &writer, 0, 3 );                   // empty stored block ...
+			put_bits( &writer, 0, (8 - writer.nCount) & 7 ); // ... starts on a byte boundary
+			put_bits( &writer, 0x0000, 16 );             // LEN
+			put_bits( &writer, 0xFFFF, 16 );             // NLEN
+		}
+		else
+			put_bits( &writer, 0, (8 - writer.nCount) & 7 );
+
+		return writer.pOut - pOut;
+	}
+
+	// Worst case: every byte a 9-bit literal, plus block header, end of block and sync flush
+	// ========================================
+	size_t deflate_bound (const size_t nSize)
+	{
+		return nSize + (nSize >> 3) + 16;
+	}
+
+	// PNG scanline bytes for each surface type:
+	//   RGBA    -> RGBA, as is
+	//   BGRA    -> RGBA, swizzled
+	//   Indexed -> palette index, INDEX_TRANSPARENT moved to the extra transparent palette entry 16
+	// ========================================
+	int get_png_bytes_per_pixel (const Surface32_t   &) { return 4; }
+	int get_png_bytes_per_pixel (const SurfaceBGRA_t &) { return 4; }
+	int get_png_bytes_per_pixel (const Surface8_t    &) { return 1; }
+
+	// ========================================
+	void copy_png_row (uint8_t *pDst, const Surface32_t &map, const int y)
+	{
+		memcpy( pDst, map.pPixels + y*map.nPitch, map.nWidth*4 );
+	}
+
+	// ========================================
+	void copy_png_row (uint8_t *pDst, const SurfaceBGRA_t &map, const int y)
+	{
+		const uint32_t *pSrc = map.pPixels + y*map.nPitch;
+		for (int x = 0; x < map.nWidth; ++x)
+		{
+			uint32_t bgra = BGRA_t::convert( pSrc[x] ); // swapping R and B is its own inverse
+			memcpy( pDst + 4*x, &bgra, 4 );
+		}
+	}
+
+	// ========================================
+	void copy_png_row (uint8_t *pDst, const Surface8_t &map, const int y)
+	{
+		const uint8_t *pSrc = map.pPixels + y*map.nPitch;
+		for (int x = 0; x < map.nWidth; ++x)
+			pDst[x] = (pSrc[x] & INDEX_TRANSPARENT) ? 16 : pSrc[x];
+	}
+
+	// Filter type 0 (None) scanlines, LZ77 finds the repeated tiles on its own
+	// ========================================
+	template<typename Surface>
+	void copy_png_rows (uint8_t *pDst, const Surface &map, const int nRowStart, const int nRows)
+	{
+		const size_t nRowBytes = 1 + (size_t)map.nWidth * get_png_bytes_per_pixel( map );
+
+		for (int y = nRowStart; y < nRowStart + nRows; ++y, pDst += nRowBytes)
+		{
+			pDst[0] = 0; // filter: None
+			copy_png_row( pDst + 1, map, y );
+		}
+	}
+
+	// Filter and deflate one strip. The strip is primed with up to 32 KB of the scanlines above it.
+	// ========================================
+	template<typename Surface>
+	void deflate_png_strip (PngStrip_t *pStrip, const Surface &map, const bool bFinal, uint8_t *pScratch, uint8_t *pOut, int32_t *pHead, int32_t *pPrev)
+	{
+		const int nRowBytes   = 1 + map.nWidth * get_png_bytes_per_pixel( map );
+		const int nDictRows   = (pStrip->nRowStart < 1 + (DEFLATE_WINDOW-1) / nRowBytes) ? pStrip->nRowStart : 1 + (DEFLATE_WINDOW-1) / nRowBytes;
+		const int nDict       = nDictRows * nRowBytes;
+
+		pStrip->nRaw = (size_t)pStrip->nRows * nRowBytes;
+		copy_png_rows( pScratch, map, pStrip->nRowStart - nDictRows, nDictRows + pStrip->nRows );
+		pStrip->nAdler = adler32_update( 1, pScratch + nDict, pStrip->nRaw );
+
+		pStrip->nDeflate = deflate_block( pOut, pScratch, nDict, (int) pStrip->nRaw, bFinal, pHead, pPrev );
+		pStrip->pDeflate = new uint8_t[ 2 + pStrip->nDeflate + 4 ];
+		memcpy( pStrip->pDeflate + 2, pOut, pStrip->nDeflate );
+	}
+
+	// ========================================
+	void write_be32 (uint8_t *pDst, const uint32_t n)
+	{
+		pDst[0] = (uint8_t)(n >> 24);
+		pDst[1] = (uint8_t)(n >> 16);
+		pDst[2] = (uint8_t)(n >>  8);
+		pDst[3] = (uint8_t)(n      );
+	}
+
+	// ========================================
+	bool write_png_chunk (FILE *pFile, const char *pType, const uint8_t *pData, const uint32_t nSize)
+	{
+		uint8_t aHead[8];
+		uint8_t aTail[4];
+
+		write_be32( aHead, nSize );
+		memcpy( aHead + 4, pType, 4 );
+		write_be32( aTail, crc32_update( crc32_update( 0, aHead + 4, 4 ), pData, nSize ) );
+
+		bool bWrote = (fwrite( aHead, 1, 8, pFile ) == 8);
+		if (nSize)
+			bWrote &= (fwrite( pData, 1, nSize, pFile ) == nSize);
+		bWrote &= (fwrite( aTail, 1, 4, pFile ) == 4);
+		return bWrote;
+	}
+
+	// Writes a surface as a PNG: 8-bit indexed with the CGA palette, or 32-bit RGBA.
+	// Horizontal strips are filtered and deflated on nThreads threads, each strip becomes one IDAT chunk.
+	// Returns the compressed size, 0 on error.
+	// ========================================
+	template<typename Surface>
+	size_t write_png (Decoder_t *pDecoder, const char *pFilename, const Surface &map, const int nMaxThreads)
+	{
+		const int    nBytesPerPixel = get_png_bytes_per_pixel( map );
+		const int    nRowBytes      = 1 + map.nWidth * nBytesPerPixel;
+		const int    nStripRows     = (nRowBytes < PNG_STRIP_BYTES) ? PNG_STRIP_BYTES / nRowBytes : 1;
+		const int    nStrips        = (map.nHeight + nStripRows - 1) / nStripRows;
+		const int    nDictRows      = 1 + (DEFLATE_WINDOW-1) / nRowBytes;
+		const size_t nScratch       = (size_t)(nStripRows + nDictRows) * nRowBytes;
+
+		PngStrip_t *aStrip = new PngStrip_t[ nStrips ];
+		for (int iStrip = 0; iStrip < nStrips; ++iStrip)
+		{
+			aStrip[ iStrip ].nRowStart = iStrip * nStripRows;
+			aStrip[ iStrip ].nRows     = (iStrip == nStrips-1) ? map.nHeight - iStrip*nStripRows : nStripRows;
+		}
+
+		int nThreads = (nMaxThreads > nStrips) ? nStrips : nMaxThreads;
+		if (nThreads < 1) nThreads = 1;
+
+		// Scratch buffers and hash chains per worker
+		const size_t nOut     = deflate_bound( (size_t)nStripRows * nRowBytes );
+		uint8_t     *pScratch = new uint8_t[ nThreads * nScratch ];
+		uint8_t     *pOut     = new uint8_t[ nThreads * nOut ];
+		int32_t     *pHead    = new int32_t[ nThreads << DEFLATE_HASH_BITS ];
+		int32_t     *pPrev    = new int32_t[ nThreads * DEFLATE_WINDOW ];
+
+		run_workers( nThreads, nStrips, [&]( const int iStrip, const int iWorker )
+		{
+			deflate_png_strip( &aStrip[ iStrip ], map, iStrip == nStrips-1,
+				pScratch + iWorker*nScratch, pOut + iWorker*nOut, pHead + (iWorker << DEFLATE_HASH_BITS), pPrev + iWorker*DEFLATE_WINDOW );
+		});
+
+		delete [] pPrev;
+		delete [] pHead;
+		delete [] pOut;
+		delete [] pScratch;
+
+		size_t nTotal = 0;
+		FILE  *pFile  = fopen( pFilename, "w+b" );
+		if (!pFile)
+		{
+			printf( "ERROR: Couldn't write: '%s'\n", pFilename );
+		}
+		else
+		{
+			const uint8_t aSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+			bool bWrote = (fwrite( aSignature, 1, 8, pFile ) == 8);
+
+			uint8_t aHeader[13];
+			write_be32( aHeader + 0, map.nWidth  );
+			write_be32( aHeader + 4, map.nHeight );
+			aHeader[ 8] = 8;                            // bit depth
+			aHeader[ 9] = (nBytesPerPixel == 1) ? 3 : 6; // color type: indexed or RGBA
+			aHeader[10] = 0;                            // compression: deflate
+			aHeader[11] = 0;                            // filter: adaptive
+			aHeader[12] = 0;                            // interlace: none
+			bWrote &= write_png_chunk( pFile, "IHDR", aHeader, sizeof(aHeader) );
+
+			if (nBytesPerPixel == 1)
+			{
+				// The 16 CGA colors plus a transparent entry for empty World Map cells
+				uint8_t aPalette[17*3];
+				uint8_t aAlpha  [17  ];
+				for (int iColor = 0; iColor < 17; ++iColor)
+				{
+					uint32_t abgr = (iColor < 16) ? gPalette[ iColor ] : 0;
+					aPalette[ iColor*3 + 0 ] = (uint8_t)(abgr      );
+					aPalette[ iColor*3 + 1 ] = (uint8_t)(abgr >>  8);
+					aPalette[ iColor*3 + 2 ] = (uint8_t)(abgr >> 16);
+					aAlpha  [ iColor       ] = (uint8_t)(abgr >> 24);
+				}
+				bWrote &= write_png_chunk( pFile, "PLTE", aPalette, sizeof(aPalette) );
+				bWrote &= write_png_chunk( pFile, "tRNS", aAlpha  , sizeof(aAlpha  ) );
+			}
+
+			// zlib stream = header + concatenated strips + Adler-32 of all the uncompressed bytes
+			uint32_t nAdler = 1;
+			for (int iStrip = 0; iStrip < nStrips; ++iStrip)
+			{
+				PngStrip_t &strip = aStrip[ iStrip ];
+				uint8_t    *pData = strip.pDeflate + 2;
+				size_t      nSize = strip.nDeflate;
+
+				nAdler = adler32_combine( nAdler, strip.nAdler, strip.nRaw );
+
+				if (iStrip == 0)
+				{
+					pData   -= 2;
+					nSize   += 2;
+					pData[0] = 0x78; // CM = deflate, 32 KB window
+					pData[1] = 0x01; // no dictionary, check bits
+				}
+				if (iStrip == nStrips-1)
+				{
+					write_be32( pData + nSize, nAdler );
+					nSize += 4;
+				}
+
+				bWrote &= write_png_chunk( pFile, "IDAT", pData, (uint32_t) nSize );
+				nTotal += nSize;
+			}
+
+			bWrote &= write_png_chunk( pFile, "IEND", NULL, 0 );
+			pDecoder->metrics.nBytesWritten += (uint64_t) ftell( pFile );
+			fclose( pFile );
+
+			if (!bWrote)
+			{
+				printf( "ERROR: Couldn't write all of: '%s'\n", pFilename );
+				nTotal = 0;
+			}
+		}
+
+		for (int iStrip = 0; iStrip < nStrips; ++iStrip)
+			delete [] aStrip[ iStrip ].pDeflate;
+		delete [] aStrip;
+
+		return nTotal;
+	}
+
+	// ========================================
+	template<typename Surface>
+	void write_map_png (Decoder_t *pDecoder, const char *pName, const Surface &map)
+	{
+		char sFileName[ MAX_FILE_NAME ];
+		sprintf( sFileName, "%sWorldMap%s_%dx%d_rooms.png", pDecoder->sOutputDir, pName, map.nRoomsW, map.nRoomsH );
+
+		size_t nSize = write_png( pDecoder, sFileName, map, get_thread_count( pDecoder ) );
+		if (nSize && !pDecoder->options.bQuiet)
+			printf( "Saved: %s (%d KB)\n", sFileName, (int)(nSize / K) );
+	}
+
+	// -png: every World Map that was rendered, indexed color if rendered with -indexed
+	// ========================================
+	void write_maps_png (Decoder_t *pDecoder)
+	{
+		if (pDecoder->options.bIndexed)
+		{
+			if (pDecoder->indexMap1D.pPixels) write_map_png( pDecoder, "1D", pDecoder->indexMap1D );
+			if (pDecoder->indexMap2D.pPixels) write_map_png( pDecoder, "2D", pDecoder->indexMap2D );
+		}
+		else
+		{
+			if (pDecoder->worldMap1D.pPixels) write_map_png( pDecoder, "1D", pDecoder->worldMap1D );
+			if (pDecoder->worldMap2D.pPixels) write_map_png( pDecoder, "2D", pDecoder->worldMap2D );
+			else
+			if (pDecoder->bitmap2D  .pPixels) write_map_png( pDecoder, "2D", pDecoder->bitmap2D   );
+		}
+	}
+
+// Deep Zoom __________________________________________________________
+
+	// Deep Zoom Image (.dzi) pyramid: level 0 is 1x1 px, the last level is the World Map at 1:1.
+	// Every level is cut into DZI_TILE x DZI_TILE px tiles (edge tiles are smaller), no overlap.
+	const int DZI_TILE = 256; // px
+
+	// A rectangle of a surface sharing its pixels, for cutting tiles without a copy
+	// ========================================
+	template<typename Format>
+	Surface_t<Format> get_sub_surface (const Surface_t<Format> &map, const int nX, const int nY, const int nWidth, const int nHeight)
+	{
+		Surface_t<Format> view = map;
+		view.pPixels = map.pPixels + (ptrdiff_t)nY*map.nPitch + nX;
+		view.nRoomsW = 1;
+		view.nRoomsH = 1;
+		view.nWidth  = nWidth;
+		view.nHeight = nHeight;
+		view.nSize   = 0; // doesn't own the pixels
+		return view;
+	}
+
+	// 2x2 box filter a rectangle of the next level down. Odd source edges repeat the last column / row.
+	// ========================================
+	template<typename Format>
+	void downsample_rect (Surface_t<Format> *pDst, const Surface_t<Format> &src, const int nX, const int nY, const int nWidth, const int nHeight)
+	{
+		const int nPairs = (2*(nX + nWidth) > src.nWidth) ? nWidth - 1 : nWidth; // odd width: last pixel has one column
+
+		for (int y = nY; y < nY + nHeight; ++y)
+		{
+			const uint32_t *pRow0 = src.pPixels + (ptrdiff_t)(2*y)*src.nPitch;
+			const uint32_t *pRow1 = (2*y+1 < src.nHeight) ? pRow0 + src.nPitch : pRow0;
+			uint32_t       *pOut  = pDst->pPixels + (ptrdiff_t)y*pDst->nPitch + nX;
+
+			gBlitter.pDownsample( pOut, pRow0 + 2*nX, pRow1 + 2*nX, nPairs );
+
+			if (nPairs < nWidth)
+			{
+				const int nLast    = src.nWidth - 1;
+				uint32_t  aRow0[2] = { pRow0[ nLast ], pRow0[ nLast ] };
+				uint32_t  aRow1[2] = { pRow1[ nLast ], pRow1[ nLast ] };
+				gBlitter.pDownsample( pOut + nPairs, aRow0, aRow1, 1 );
+			}
+		}
+	}
+
+	// Writes every level of the pyramid as .png tiles, lowest level first down to 1x1 px.
+	// Each level is box filtered from the one above it tile by tile, on nThreads threads.
+	// Tiles that only cover empty World Map cells are neither filtered nor written.
+	// ========================================
+	template<typename Format>
+	void write_pyramid (Decoder_t *pDecoder, const Surface_t<Format> &world)
+	{
+		const int nMapW = pDecoder->world.nMapWidth;
+		const int nMapH = pDecoder->world.nMapHeight;
+
+		char sBaseName[ MAX_DIR_NAME + 64 ]; // + "_files/#/#_#.png" fits in MAX_FILE_NAME
+		char sDirName [ MAX_DIR_NAME + 72 ];
+		sprintf( sBaseName, "%sWorldMap2D_%dx%d_rooms", pDecoder->sOutputDir, nMapW, nMapH );
+		sprintf( sDirName , "%s_files", sBaseName );
+
+		int nLevels = 1;
+		for (int n = (world.nWidth > world.nHeight) ? world.nWidth : world.nHeight; n > 1; n = (n + 1) / 2)
+			++nLevels;
+
+		if (!pDecoder->options.bQuiet)
+			printf( "Deep Zoom pyramid: %d x %d px, %d levels of %d x %d px tiles\n", world.nWidth, world.nHeight, nLevels, DZI_TILE, DZI_TILE );
+
+		bool *aRoomCell = new bool[ nMapW * nMapH ](); // () = all empty
+		for (int iRoom = 0; iRoom < pDecoder->world.nRooms; ++iRoom)
+			aRoomCell[ (pDecoder->aRooms[ iRoom ].nRoomY - pDecoder->world.nMinRoomY)*nMapW + (pDecoder->aRooms[ iRoom ].nRoomX - pDecoder->world.nMinRoomX) ] = true;
+
+		const int nThreads = get_thread_count( pDecoder );
+
+		make_directory( sDirName );
+
+		Surface_t<Format> level    = world; // not owned until the first downsample
+		Surface_t<Format> above;
+		bool             *aAbove   = NULL;  // non-empty tiles of the level above
+		int               nAboveW  = 0;     // tiles
+		int               nAboveH  = 0;
+		std::atomic<int>  nWritten( 0 );
+		std::atomic<int>  nFailed ( 0 );
+		int               nSkipped = 0;
+
+		for (int iLevel = nLevels - 1; iLevel >= 0; --iLevel)
+		{
+			const bool bBase = (iLevel == nLevels - 1);
+			if (!bBase)
+			{
+				above = level;
+				alloc_surface( &level, 1, 1, (above.nWidth + 1) / 2, (above.nHeight + 1) / 2 );
+			}
+
+			const int nTilesW = (level.nWidth  + DZI_TILE - 1) / DZI_TILE;
+			const int nTilesH = (level.nHeight + DZI_TILE - 1) / DZI_TILE;
+			const int nTiles  = nTilesW * nTilesH;
+			bool     *aTiles  = new bool[ nTiles ];
+
+			for (int iTileY = 0; iTileY < nTilesH; ++iTileY)
+				for (int iTileX = 0; iTileX < nTilesW; ++iTileX)
+				{
+					bool bUsed = false;
+					if (bBase)
+					{
+						const int x0 = iTileX * DZI_TILE, x1 = ((x0 + DZI_TILE < level.nWidth ) ? x0 + DZI_TILE : level.nWidth ) - 1;
+						const int y0 = iTileY * DZI_TILE, y1 = ((y0 + DZI_TILE < level.nHeight) ? y0 + DZI_TILE : level.nHeight) - 1;
+						for (int iCellY = y0 / ROOM2D_H_PX; iCellY <= y1 / ROOM2D_H_PX; ++iCellY)
+							for (int iCellX = x0 / ROOM2D_W_PX; iCellX <= x1 / ROOM2D_W_PX; ++iCellX)
+								bUsed |= aRoomCell[ iCellY*nMapW + iCellX ];
+					}
+					else
+					{
+						for (int iChildY = 2*iTileY; iChildY < 2*iTileY + 2 && iChildY < nAboveH; ++iChildY)
+							for (int iChildX = 2*iTileX; iChildX < 2*iTileX + 2 && iChildX < nAboveW; ++iChildX)
+								bUsed |= aAbove[ iChildY*nAboveW + iChildX ];
+					}
+					aTiles[ iTileY*nTilesW + iTileX ] = bUsed;
+					nSkipped += bUsed ? 0 : 1;
+				}
+
+			char sLevelDir[ MAX_FILE_NAME ];
+			sprintf( sLevelDir, "%s/%d", sDirName, iLevel );
+			make_directory( sLevelDir );
+
+			// Every tile downsamples and deflates its own rectangle, one tile per worker at a time
+			run_workers( nThreads, nTiles, [&]( const int iTile, const int )
+			{
+				if (!aTiles[ iTile ])
+					return;
+
+				const int nX = (iTile % nTilesW) * DZI_TILE;
+				const int nY = (iTile / nTilesW) * DZI_TILE;
+				const int nW = (nX + DZI_TILE < level.nWidth ) ? DZI_TILE : level.nWidth  - nX;
+				const int nH = (nY + DZI_TILE < level.nHeight) ? DZI_TILE : level.nHeight - nY;
+
+				if (!bBase)
+					downsample_rect( &level, above, nX, nY, nW, nH );
+
+				char sTileName[ MAX_FILE_NAME ];
+				sprintf( sTileName, "%s/%d_%d.png", sLevelDir, iTile % nTilesW, iTile / nTilesW );
+				if (write_png( pDecoder, sTileName, get_sub_surface( level, nX, nY, nW, nH ), 1 ))
+					nWritten++;
+				else
+					nFailed++;
+			});
+
+			if (!bBase && (iLevel < nLevels - 2)) // the level above the first downsample is the World Map itself
+				free_surface( &above );
+
+			delete [] aAbove;
+			aAbove  = aTiles;
+			nAboveW = nTilesW;
+			nAboveH = nTilesH;
+		}
+
+		if (nLevels > 1)
+			free_surface( &level );
+		delete [] aAbove;
+		delete [] aRoomCell;
+
+		char sDziName[ MAX_FILE_NAME ];
+		sprintf( sDziName, "%s.dzi", sBaseName );
+
+		FILE *pDzi = fopen( sDziName, "wb" );
+		if (pDzi)
+		{
+			fprintf( pDzi, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" );
+			fprintf( pDzi, "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" TileSize=\"%d\" Overlap=\"0\" Format=\"png\">\n", DZI_TILE );
+			fprintf( pDzi, "  <Size Width=\"%d\" Height=\"%d\"/>\n", world.nWidth, world.nHeight );
+			fprintf( pDzi, "</Image>\n" );
+			fclose( pDzi );
+		}
+		else
+			printf( "ERROR: Couldn't write: '%s'\n", sDziName );
+
+		if (nFailed)
+			printf( "ERROR: Couldn't write %d tiles\n", (int) nFailed );
+		if (!pDecoder->options.bQuiet)
+			printf( "Saved: %s + %s/ (%d tiles, %d empty skipped)\n", sDziName, sDirName, (int) nWritten, nSkipped );
+	}
+
+	// -dzi: the pyramid is cut from the rendered 2D World Map, indexed renders are expanded to RGBA first
+	// ========================================
+	void write_map2D_pyramid (Decoder_t *pDecoder)
+	{
+		if (pDecoder->options.bIndexed)
+		{
+			Surface32_t world;
+			alloc_surface( &world, pDecoder->indexMap2D.nRoomsW, pDecoder->indexMap2D.nRoomsH, ROOM2D_W_PX, ROOM2D_H_PX );
+			for (int y = 0; y < world.nHeight; ++y)
+				expand_row<RGBA_t>( world.pPixels + y*world.nPitch, pDecoder->indexMap2D.pPixels + y*pDecoder->indexMap2D.nPitch, world.nWidth );
+
+			write_pyramid( pDecoder, world );
+			free_surface( &world );
+		}
+		else
+		if (pDecoder->worldMap2D.pPixels)
+			write_pyramid( pDecoder, pDecoder->worldMap2D );
+		else
+			write_pyramid( pDecoder, pDecoder->bitmap2D );
+	}
+
+// Incremental ________________________________________________________
+
+	// -incremental: a cache of per-room content hashes from the last run.
+	// Rooms whose hash changed are re-rendered on their own and patched into the existing output files.
+	const char     CACHE_FILE[]  = "yhtwtg.cache";
+	const char     CACHE_MAGIC[] = "YHTWTGC";  // 8 bytes with the terminator
+	const uint32_t CACHE_VERSION = 1;          // bump when rendering changes the output pixels
+
+	struct CacheHeader_t
+	{
+		char     aMagic[8];
+		uint32_t nVersion;
+		int32_t  nRooms;
+		int32_t  nMapWidth;
+		int32_t  nMapHeight;
+		int32_t  nMinRoomX;
+		int32_t  nMinRoomY;
+		int32_t  bRender1D;   // options that change which files exist or their layout
+		int32_t  bRawData;
+		int32_t  nBitmapBits;
+		uint64_t nAtlasHash;  // tiles + palette
+		uint64_t nFontHash;   // font + palette
+		// uint64_t aRoomHash[ nRooms ];
+		// uint64_t aCellHash[ nMapHeight ][ nMapWidth ]; 0 = empty cell
+	};
+
+	// A room's tiles, its name and its World Map position
+	// ========================================
+	uint64_t hash_room (const Decoder_t *pDecoder, const int iRoom)
+	{
+		const Room_t *pRoom = &pDecoder->aRooms[ iRoom ];
+		const char   *pDesc = pRoom->pRoomDesc->pDesc;
+		int32_t       aPos[2] = { pRoom->nRoomX, pRoom->nRoomY };
+
+		uint64_t nHash = hash_bytes( pRoom->pRoomData, sizeof(int16_t) * pRoom->nRoomSize );
+		nHash = hash_bytes( pDesc, strlen( pDesc ), nHash );
+		nHash = hash_bytes( aPos, sizeof(aPos), nHash );
+		return nHash ? nHash : 1; // 0 = empty cell
+	}
+
+	// ========================================
+	void make_cache_header (const Decoder_t *pDecoder, CacheHeader_t *pHeader)
+	{
+		memset( pHeader, 0, sizeof(*pHeader) );
+		memcpy( pHeader->aMagic, CACHE_MAGIC, sizeof(pHeader->aMagic) );
+		pHeader->nVersion    = CACHE_VERSION;
+		pHeader->nRooms      = pDecoder->world.nRooms;
+		pHeader->nMapWidth   = pDecoder->world.nMapWidth;
+		pHeader->nMapHeight  = pDecoder->world.nMapHeight;
+		pHeader->nMinRoomX   = pDecoder->world.nMinRoomX;
+		pHeader->nMinRoomY   = pDecoder->world.nMinRoomY;
+		pHeader->bRender1D   = pDecoder->options.bRender1D;
+		pHeader->bRawData    = pDecoder->options.bRawData;
+		pHeader->nBitmapBits = pDecoder->options.nBitmapBits;
+		pHeader->nAtlasHash  = hash_bytes( gPalette, sizeof(gPalette), hash_bytes( pDecoder->assets.pTilesIndexed, sizeof(gTilesIndexed) ) );
+		pHeader->nFontHash   = hash_bytes( gPalette, sizeof(gPalette), hash_bytes( pDecoder->assets.pFontIndexed, sizeof(gUnpackedFont8x8Indexed) ) );
+	}
+
+	// ========================================
+	void hash_rooms (Decoder_t *pDecoder)
+	{
+		delete [] pDecoder->aRoomHash;
+		pDecoder->aRoomHash = new uint64_t[ pDecoder->world.nRooms ];
+
+		for (int iRoom = 0; iRoom < pDecoder->world.nRooms; ++iRoom)
+			pDecoder->aRoomHash[ iRoom ] = hash_room( pDecoder, iRoom );
+	}
+
+	// ========================================
+	uint64_t get_cell_hash (const Decoder_t *pDecoder, const int iCell)
+	{
+		return (pDecoder->aRoomIndex[ iCell ] < 0) ? 0 : pDecoder->aRoomHash[ pDecoder->aRoomIndex[ iCell ] ];
+	}
+
+	// ========================================
+	void save_cache (Decoder_t *pDecoder)
+	{
+		const int nCells = pDecoder->world.nMapWidth * pDecoder->world.nMapHeight;
+
+		CacheHeader_t header;
+		make_cache_header( pDecoder, &header );
+
+		char sCacheName[ MAX_FILE_NAME ];
+		sprintf( sCacheName, "%s%s", pDecoder->sOutputDir, CACHE_FILE );
+
+		FILE *pFile = fopen( sCacheName, "wb" );
+		if (!pFile)
+		{
+			printf( "ERROR: Couldn't write: '%s'\n", sCacheName );
+			return;
+		}
+
+		bool bWrote = (fwrite( &header, sizeof(header), 1, pFile ) == 1);
+		bWrote &= (fwrite( pDecoder->aRoomHash, sizeof(uint64_t), pDecoder->world.nRooms, pFile ) == (size_t) pDecoder->world.nRooms);
+		for (int iCell = 0; iCell < nCells; ++iCell)
+		{
+			uint64_t nHash = get_cell_hash( pDecoder, iCell );
+			bWrote &= (fwrite( &nHash, sizeof(nHash), 1, pFile ) == 1);
+		}
+		pDecoder->metrics.nBytesWritten += (uint64_t) ftell( pFile );
+		fclose( pFile );
+
+		if (!bWrote)
+			printf( "ERROR: Couldn't write all of: '%s'\n", sCacheName );
+		else
+		if (!pDecoder->options.bQuiet)
+			printf( "Saved: %s\n", sCacheName );
+	}
+
+	// Opens an existing output file for patching, it must have exactly the size a full build writes
+	// ========================================
+	FILE* open_patch_file (const char *pFilename, const uint64_t nSize)
+	{
+		if (get_file_size( pFilename ) != nSize)
+		{
+			printf( "Incremental: '%s' missing or wrong size, full rebuild\n", pFilename );
+			return NULL;
+		}
+		return fopen( pFilename, "r+b" );
+	}
+
+	// Re-render only the rooms whose hash changed since the cached run, patching the output files in place.
+	// Returns false when a full rebuild is needed: no or stale cache, world resized, options or atlas / font changed.
+	// ========================================
+	bool update_files (Decoder_t *pDecoder, const int nRooms)
+	{
+		const int nMapW   = pDecoder->world.nMapWidth;
+		const int nMapH   = pDecoder->world.nMapHeight;
+		const int nCells  = nMapW * nMapH;
+		const int nWidth  = nMapW * ROOM2D_W_PX;
+		const int nHeight = nMapH * ROOM2D_H_PX;
+
+		CacheHeader_t expected, cached;
+		make_cache_header( pDecoder, &expected );
+
+		char sCacheName[ MAX_FILE_NAME ];
+		sprintf( sCacheName, "%s%s", pDecoder->sOutputDir, CACHE_FILE );
+
+		FILE *pCache = fopen( sCacheName, "rb" );
+		if (!pCache)
+		{
+			printf( "Incremental: no %s, full rebuild\n", sCacheName );
+			return false;
+		}
+
+		uint64_t *aOldRoom = new uint64_t[ nRooms ];
+		uint64_t *aOldCell = new uint64_t[ nCells ];
+		bool      bValid   = (fread( &cached, sizeof(cached), 1, pCache ) == 1)
+		                  && (memcmp( &cached, &expected, sizeof(cached) ) == 0)
+		                  && (fread( aOldRoom, sizeof(uint64_t), nRooms, pCache ) == (size_t) nRooms)
+		                  && (fread( aOldCell, sizeof(uint64_t), nCells, pCache ) == (size_t) nCells);
+		pDecoder->metrics.nBytesRead += (uint64_t) ftell( pCache );
+		fclose( pCache );
+
+		FILE *pData1D = NULL;
+		FILE *pData2D = NULL;
+		FILE *pBitmap = NULL;
+		char  sFileName[ MAX_FILE_NAME ];
+
+		const uint32_t nBMPPitch  = get_bitmap_pitch( nWidth, pDecoder->options.nBitmapBits );
+		const uint32_t nBMPOffset = get_bitmap_offset( pDecoder->options.nBitmapBits );
+
+		if (!bValid)
+			printf( "Incremental: %s is stale (world, options, atlas or font changed), full rebuild\n", sCacheName );
+		else
+		{
+			if (pDecoder->options.bRawData && pDecoder->options.bRender1D)
+			{
+				sprintf( sFileName, "%sWorldMap1D_%dx%d_rooms_rgba32_%dx%d.data", pDecoder->sOutputDir, 1, nRooms, ROOM1C_W_PX, nRooms*ROOM1C_H_PX );
+				bValid &= ((pData1D = open_patch_file( sFileName, 4ull * ROOM1C_W_PX * ROOM1C_H_PX * nRooms )) != NULL);
+			}
+			if (pDecoder->options.bRawData)
+			{
+				sprintf( sFileName, "%sWorldMap2D_%dx%d_rooms_rgba32_%dx%d.data", pDecoder->sOutputDir, nMapW, nMapH, nWidth, nHeight );
+				bValid &= ((pData2D = open_patch_file( sFileName, 4ull * nWidth * nHeight )) != NULL);
+			}
+			sprintf( sFileName, "%sWorldMap2D_%dx%d_rooms.bmp", pDecoder->sOutputDir, nMapW, nMapH );
+			bValid &= ((pBitmap = open_patch_file( sFileName, (uint64_t) nBMPOffset + (uint64_t) nBMPPitch * nHeight )) != NULL);
+		}
+
+		int  nDirtyRooms = 0;
+		int  nDirtyCells = 0;
+		bool bWrote      = true;
+
+		if (bValid)
+		{
+			// Rooms are rendered indexed then expanded per file, same bytes as a full build
+			Surface8_t room;
+			uint32_t  *pRow = new uint32_t[ ROOM2D_W_PX ]();
+
+			alloc_surface( &room, 1, 1, ROOM1C_W_PX, ROOM1C_H_PX, INDEX_TRANSPARENT );
+			for (int iRoom = 0; pData1D && (iRoom < nRooms); ++iRoom)
+			{
+				if (aOldRoom[ iRoom ] == pDecoder->aRoomHash[ iRoom ])
+					continue;
+
+				memset( room.pPixels, INDEX_TRANSPARENT, room.nSize );
+				draw_room( pDecoder, &room, iRoom, 0, 0, NULL );
+
+				bWrote &= seek_file( pData1D, 4ull * ROOM1C_W_PX * ROOM1C_H_PX * iRoom );
+				for (int y = 0; y < ROOM1C_H_PX; ++y)
+				{
+					expand_row<RGBA_t>( pRow, room.pPixels + y*room.nPitch, ROOM1C_W_PX );
+					bWrote &= (fwrite( pRow, 4, ROOM1C_W_PX, pData1D ) == (size_t) ROOM1C_W_PX);
+				}
+				pDecoder->metrics.nBytesWritten += 4ull * ROOM1C_W_PX * ROOM1C_H_PX;
+				nDirtyRooms++;
+			}
+			free_surface( &room );
+
+			// 2D cells: a room changed, appeared, moved in or out
+			alloc_surface( &room, 1, 1, ROOM2D_W_PX, ROOM2D_H_PX, INDEX_TRANSPARENT );
+			for (int iCell = 0; iCell < nCells; ++iCell)
+			{
+				if (aOldCell[ iCell ] == get_cell_hash( pDecoder, iCell ))
+					continue;
+
+				const int nCellX = iCell % nMapW;
+				const int nCellY = iCell / nMapW;
+				render_room_region( pDecoder, nCellX, nCellY, 1, 1, &room );
+
+				for (int y = 0; y < ROOM2D_H_PX; ++y)
+				{
+					const uint8_t *pSrc   = room.pPixels + y*room.nPitch;
+					const int      nWorldY = nCellY*ROOM2D_H_PX + y;
+
+					if (pData2D)
+					{
+						expand_row<RGBA_t>( pRow, pSrc, ROOM2D_W_PX );
+						bWrote &= seek_file( pData2D, 4 * ((uint64_t) nWorldY * nWidth + nCellX*ROOM2D_W_PX) );
+						bWrote &= (fwrite( pRow, 4, ROOM2D_W_PX, pData2D ) == (size_t) ROOM2D_W_PX);
+						pDecoder->metrics.nBytesWritten += 4 * ROOM2D_W_PX;
+					}
+
+					// .BMP is bottom-up. Room widths are a multiple of 8 px so 4-bpp rows start on a byte.
+					const uint32_t nRowBytes = get_bitmap_pitch( ROOM2D_W_PX, pDecoder->options.nBitmapBits );
+					if (pDecoder->options.nBitmapBits <= 8)
+						pack_bitmap_row( (uint8_t*) pRow, pSrc, ROOM2D_W_PX, pDecoder->options.nBitmapBits );
+					else
+						expand_row<BGRA_t>( pRow, pSrc, ROOM2D_W_PX );
+					bWrote &= seek_file( pBitmap, nBMPOffset + (uint64_t)(nHeight - 1 - nWorldY) * nBMPPitch + (uint64_t) nCellX * nRowBytes );
+					bWrote &= (fwrite( pRow, 1, nRowBytes, pBitmap ) == nRowBytes);
+					pDecoder->metrics.nBytesWritten += nRowBytes;
+				}
+				nDirtyCells++;
+			}
+			free_surface( &room );
+			delete [] pRow;
+		}
+
+		if (pData1D) fclose( pData1D );
+		if (pData2D) fclose( pData2D );
+		if (pBitmap) fclose( pBitmap );
+		delete [] aOldCell;
+		delete [] aOldRoom;
+
+		if (!bValid)
+			return false;
+
+		if (!bWrote)
+		{
+			printf( "ERROR: Couldn't patch the output files, full rebuild\n" );
+			return false;
+		}
+
+		printf( "Incremental: patched %d of %d rooms (1D), %d of %d cells (2D)\n", nDirtyRooms, nRooms, nDirtyCells, nCells );
+
+		// The histogram still covers every room, counting tiles is cheap next to drawing them
+		memset( pDecoder->aHistogram, 0, sizeof(pDecoder->aHistogram) );
+		for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+		{
+			RoomTiles_t tiles;
+			prepare_room( pDecoder, &tiles, iRoom, pDecoder->aHistogram );
+		}
+		dump_histogram( pDecoder );
+		return true;
+	}
+
+// Baked ______________________________________________________________
+
+	// -bake writes, and -baked maps, a world that is ready to render:
+	//   header | atlas RGBA | atlas BGRA | atlas indexed | font RGBA | font indexed | room index | room tiles | titles
+	// Every section starts on a BAKED_ALIGN boundary. Tiles are the .map's int16 column-major rooms.
+	// NOTE: Little endian, same as the .map
+	const char     BAKED_FILE[]  = "yhtwtg.baked";
+	const char     BAKED_MAGIC[] = "YHTWTGB"; // 8 bytes with the terminator
+	const uint32_t BAKED_VERSION = 1;
+	const size_t   BAKED_ALIGN   = 64;        // cache line
+	const uint32_t BAKED_NO_TEXT = 0xFFFFFFFF;
+
+	struct BakedHeader_t
+	{
+		char        aMagic[8];
+		uint32_t    nVersion;
+		uint32_t    nRooms;
+		WorldMeta_t world;
+		MapHeader_t map;       // 22 bytes, packed
+		uint8_t     aPad[2];
+		uint64_t    nFileSize;
+		uint64_t    nAtlasRGBA;   // section offsets from the start of the file
+		uint64_t    nAtlasBGRA;
+		uint64_t    nAtlasIndexed;
+		uint64_t    nFontRGBA;
+		uint64_t    nFontIndexed;
+		uint64_t    nRoomIndex;   // BakedRoom_t[ nRooms ]
+		uint64_t    nRoomTiles;
+		uint64_t    nText;
+	};
+
+	struct BakedRoom_t
+	{
+		int32_t  nRoomId;
+		int32_t  nRoomX;
+		int32_t  nRoomY;
+		int32_t  nRoomSize; // tiles
+		uint64_t nTiles;    // offset of int16_t[ nRoomSize ]
+		uint32_t nDesc;     // offset into the titles, or BAKED_NO_TEXT
+		uint32_t nDesc2;
+	};
+
+	// ========================================
+	size_t align_baked (const size_t nOffset)
+	{
+		return (nOffset + BAKED_ALIGN - 1) & ~(BAKED_ALIGN - 1);
+	}
+
+	// Save the parsed map with these atlases and font. aRemap: NULL, or the new dense index of every atlas tile,
+	// the rooms' tiles are renumbered with it, see write_repacked()
+	// ========================================
+	void bake_world (Decoder_t *pDecoder, const char *pFileName, const Assets_t &assets, const int *aRemap)
+	{
+		const int nRooms = pDecoder->world.nRooms;
+
+		BakedHeader_t header;
+		memset( &header, 0, sizeof(header) );
+		memcpy( header.aMagic, BAKED_MAGIC, sizeof(header.aMagic) );
+		header.nVersion = BAKED_VERSION;
+		header.nRooms   = nRooms;
+		header.world    = pDecoder->world;
+		header.map      = pDecoder->mapHeader;
+
+		size_t nText = 0;
+		for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+		{
+			const RoomDesc_t *pDesc = pDecoder->aRooms[ iRoom ].pRoomDesc;
+			if (pDesc->pDesc ) nText += strlen( pDesc->pDesc  ) + 1;
+			if (pDesc->pDesc2) nText += strlen( pDesc->pDesc2 ) + 1;
+		}
+
+		size_t nOffset = align_baked( sizeof(header) );
+		header.nAtlasRGBA    = nOffset; nOffset = align_baked( nOffset + sizeof(gTilesRGBA) );
+		header.nAtlasBGRA    = nOffset; nOffset = align_baked( nOffset + sizeof(gTilesBGRA) );
+		header.nAtlasIndexed = nOffset; nOffset = align_baked( nOffset + sizeof(gTilesIndexed) );
+		header.nFontRGBA     = nOffset; nOffset = align_baked( nOffset + sizeof(gUnpackedFont8x8RGBA) );
+		header.nFontIndexed  = nOffset; nOffset = align_baked( nOffset + sizeof(gUnpackedFont8x8Indexed) );
+		header.nRoomIndex    = nOffset; nOffset = align_baked( nOffset + sizeof(BakedRoom_t) * nRooms );
+		header.nRoomTiles    = nOffset;
+		for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+			nOffset = align_baked( nOffset + sizeof(int16_t) * pDecoder->aRooms[ iRoom ].nRoomSize );
+		header.nText         = nOffset; nOffset = align_baked( nOffset + nText );
+		header.nFileSize     = nOffset;
+
+		uint8_t *pBaked = new uint8_t[ header.nFileSize ](); // () = zero the padding
+
+		memcpy( pBaked                       , &header             , sizeof(header) );
+		memcpy( pBaked + header.nAtlasRGBA   , assets.pTilesRGBA   , sizeof(gTilesRGBA) );
+		memcpy( pBaked + header.nAtlasBGRA   , assets.pTilesBGRA   , sizeof(gTilesBGRA) );
+		memcpy( pBaked + header.nAtlasIndexed, assets.pTilesIndexed, sizeof(gTilesIndexed) );
+		memcpy( pBaked + header.nFontRGBA    , assets.pFontRGBA    , sizeof(gUnpackedFont8x8RGBA) );
+		memcpy( pBaked + header.nFontIndexed , assets.pFontIndexed , sizeof(gUnpackedFont8x8Indexed) );
+
+		BakedRoom_t *pIndex = (BakedRoom_t*)(pBaked + header.nRoomIndex);
+		size_t       nTiles = header.nRoomTiles;
+		char        *pText  = (char*)(pBaked + header.nText);
+		uint32_t     iText  = 0;
+
+		auto add_text = [&]( const char *pString ) -> uint32_t
+		{
+			if (!pString)
+				return BAKED_NO_TEXT;
+
+			uint32_t iStart = iText;
+			size_t   nLen   = strlen( pString ) + 1;
+			memcpy( pText + iText, pString, nLen );
+			iText += (uint32_t) nLen;
+			return iStart;
+		};
+
+		for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+		{
+			const Room_t *pRoom = &pDecoder->aRooms[ iRoom ];
+			BakedRoom_t  *pBake = &pIndex[ iRoom ];
+
+			pBake->nRoomId   = pRoom->nRoomId;
+			pBake->nRoomX    = pRoom->nRoomX;
+			pBake->nRoomY    = pRoom->nRoomY;
+			pBake->nRoomSize = pRoom->nRoomSize;
+			pBake->nTiles    = nTiles;
+			pBake->nDesc     = add_text( pRoom->pRoomDesc->pDesc  );
+			pBake->nDesc2    = add_text( pRoom->pRoomDesc->pDesc2 );
+
+			int16_t *pTiles = (int16_t*)(pBaked + nTiles);
+			memcpy( pTiles, pRoom->pRoomData, sizeof(int16_t) * pRoom->nRoomSize );
+			nTiles = align_baked( nTiles + sizeof(int16_t) * pRoom->nRoomSize );
+
+			if (aRemap)
+				for (int iTile = 0; iTile < pRoom->nRoomSize; ++iTile)
+				{
+					const int iIndex = get_tile_index( pTiles[ iTile ] );
+					if (iIndex >= 0) // tiles outside the atlas stay as they are
+						pTiles[ iTile ] = (int16_t) get_tile_id( aRemap[ iIndex ] );
+				}
+		}
+
+		save_file( pDecoder, pFileName, pBaked, header.nFileSize );
+		delete [] pBaked;
+	}
+
+	// -bake: save the parsed map, converted atlas and unpacked font
+	// ========================================
+	void write_baked (Decoder_t *pDecoder)
+	{
+		char sFileName[ MAX_FILE_NAME ];
+		sprintf( sFileName, "%s%s", pDecoder->sOutputDir, BAKED_FILE );
+		bake_world( pDecoder, sFileName, pDecoder->assets, NULL );
+
+		end_stage( pDecoder, "write_baked" );
+		write_metrics( pDecoder );
+	}
+
+	// Returns true if nSize bytes at nOffset are inside the mapped file
+	// ========================================
+	bool is_baked_section (const MapView_t &map, const uint64_t nOffset, const uint64_t nSize)
+	{
+		return (nOffset <= map.nSize) && (nSize <= map.nSize - nOffset);
+	}
+
+	// Returns true if a title offset is BAKED_NO_TEXT, or a NUL-terminated string inside the titles
+	// ========================================
+	bool is_baked_text (const MapView_t &map, const uint64_t nText, const uint32_t nDesc)
+	{
+		if (nDesc == BAKED_NO_TEXT)
+			return true;
+
+		const uint64_t nStart = nText + nDesc;
+		return (nStart < map.nSize) && (memchr( map.pData + nStart, 0, map.nSize - nStart ) != NULL);
+	}
+
+	// Bounds check every offset of a baked world before anything points into it: a corrupt file could point anywhere.
+	// The header's magic, version and size are already checked.
+	// ========================================
+	bool check_baked (const MapView_t &map, const char *pFileName)
+	{
+		const BakedHeader_t *pHeader = (const BakedHeader_t*) map.pData;
+		const WorldMeta_t   &world   = pHeader->world;
+
+		if ((!is_baked_section( map, pHeader->nAtlasRGBA   , sizeof(gTilesRGBA)              ))
+		||  (!is_baked_section( map, pHeader->nAtlasBGRA   , sizeof(gTilesBGRA)              ))
+		||  (!is_baked_section( map, pHeader->nAtlasIndexed, sizeof(gTilesIndexed)           ))
+		||  (!is_baked_section( map, pHeader->nFontRGBA    , sizeof(gUnpackedFont8x8RGBA)    ))
+		||  (!is_baked_section( map, pHeader->nFontIndexed , sizeof(gUnpackedFont8x8Indexed) ))
+		||  (!is_baked_section( map, pHeader->nRoomIndex   , sizeof(BakedRoom_t) * pHeader->nRooms ))
+		||  (!is_baked_section( map, pHeader->nText        , 0 ))
+		||  ((pHeader->nAtlasRGBA | pHeader->nAtlasBGRA | pHeader->nFontRGBA | pHeader->nRoomIndex) % alignof(uint64_t)))
+		{
+			printf( "ERROR: '%s' has a section outside the file or misaligned\n", pFileName );
+			return false;
+		}
+
+		if (((uint32_t) world.nRooms != pHeader->nRooms)
+		||  (world.nMinRoomX > world.nMaxRoomX) || ((int64_t) world.nMaxRoomX - world.nMinRoomX + 1 != world.nMapWidth )
+		||  (world.nMinRoomY > world.nMaxRoomY) || ((int64_t) world.nMaxRoomY - world.nMinRoomY + 1 != world.nMapHeight)
+		||  (!is_world_in_bounds( world.nMapWidth, world.nMapHeight )))
+		{
+			printf( "ERROR: '%s' has an invalid world: %d rooms, %d x %d\n", pFileName, world.nRooms, world.nMapWidth, world.nMapHeight );
+			return false;
+		}
+
+		const BakedRoom_t *pIndex = (const BakedRoom_t*)(map.pData + pHeader->nRoomIndex);
+		for (uint32_t iRoom = 0; iRoom < pHeader->nRooms; ++iRoom)
+		{
+			const BakedRoom_t *pBake = &pIndex[ iRoom ];
+
+			if ((pBake->nRoomSize < 0) || (pBake->nRoomSize > ROOM1C_Z)
+			||  (pBake->nTiles % alignof(int16_t))
+			||  (!is_baked_section( map, pBake->nTiles, sizeof(int16_t) * pBake->nRoomSize )))
+			{
+				printf( "ERROR: '%s' room #%d has invalid tiles: %d @ %06llX\n", pFileName, iRoom, pBake->nRoomSize, (unsigned long long) pBake->nTiles );
+				return false;
+			}
+
+			if ((pBake->nRoomX < world.nMinRoomX) || (pBake->nRoomX > world.nMaxRoomX)
+			||  (pBake->nRoomY < world.nMinRoomY) || (pBake->nRoomY > world.nMaxRoomY))
+			{
+				printf( "ERROR: '%s' room #%d (%+d x %+d) is outside the world\n", pFileName, iRoom, pBake->nRoomX, pBake->nRoomY );
+				return false;
+			}
+
+			if (!is_baked_text( map, pHeader->nText, pBake->nDesc ) || !is_baked_text( map, pHeader->nText, pBake->nDesc2 ))
+			{
+				printf( "ERROR: '%s' room #%d has a title outside the file\n", pFileName, iRoom );
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// -baked: map a baked world into the decoder map and point the rooms, atlas and font at it. No parsing, no conversion.
+	// ========================================
+	bool load_baked (Decoder_t *pDecoder)
+	{
+		if (!map_file( pDecoder->pMapFile, &pDecoder->map ))
+		{
+			printf( "ERROR: Couldn't map: '%s', create it with -bake\n", pDecoder->pMapFile );
+			return false;
+		}
+
+		const BakedHeader_t *pHeader = (const BakedHeader_t*) pDecoder->map.pData;
+		if ((pDecoder->map.nSize < sizeof(BakedHeader_t))
+		||  (memcmp( pHeader->aMagic, BAKED_MAGIC, sizeof(pHeader->aMagic) ) != 0)
+		||  (pHeader->nVersion  != BAKED_VERSION)
+		||  (pHeader->nFileSize != pDecoder->map.nSize)
+		||  (pHeader->nRooms    >  (uint32_t) MAX_ROOM))
+		{
+			printf( "ERROR: '%s' is not a version %d baked world, recreate it with -bake\n", pDecoder->pMapFile, BAKED_VERSION );
+			unmap_file( &pDecoder->map );
+			return false;
+		}
+
+		if (!check_baked( pDecoder->map, pDecoder->pMapFile ))
+		{
+			unmap_file( &pDecoder->map );
+			return false;
+		}
+
+		pDecoder->assets.pTilesRGBA    = (const uint32_t*)(pDecoder->map.pData + pHeader->nAtlasRGBA   );
+		pDecoder->assets.pTilesBGRA    = (const uint32_t*)(pDecoder->map.pData + pHeader->nAtlasBGRA   );
+		pDecoder->assets.pTilesIndexed = (const uint8_t *)(pDecoder->map.pData + pHeader->nAtlasIndexed);
+		pDecoder->assets.pFontRGBA     = (const uint32_t*)(pDecoder->map.pData + pHeader->nFontRGBA    );
+		pDecoder->assets.pFontIndexed  = (const uint8_t *)(pDecoder->map.pData + pHeader->nFontIndexed );
+
+		pDecoder->metrics.nBytesRead += pDecoder->map.nSize;
+		pDecoder->world     = pHeader->world;
+		pDecoder->mapHeader = pHeader->map;
+
+		const BakedRoom_t *pIndex = (const BakedRoom_t*)(pDecoder->map.pData + pHeader->nRoomIndex);
+		const char        *pText  = (const char       *)(pDecoder->map.pData + pHeader->nText     );
+
+		delete [] pDecoder->aRooms;
+		delete [] pDecoder->aBakedDesc;
+		pDecoder->aRooms     = new Room_t    [ pHeader->nRooms ](); // () = zero initialize
+		pDecoder->aBakedDesc = new RoomDesc_t[ pHeader->nRooms ]();
+		for (uint32_t iRoom = 0; iRoom < pHeader->nRooms; ++iRoom)
+		{
+			const BakedRoom_t *pBake = &pIndex[ iRoom ];
+			RoomDesc_t        *pDesc = &pDecoder->aBakedDesc[ iRoom ];
+			Room_t            *pRoom = &pDecoder->aRooms[ iRoom ];
+
+			pDesc->nRoomX    = (int8_t) pBake->nRoomX;
+			pDesc->nRoomY    = (int8_t) pBake->nRoomY;
+			pDesc->pDesc     = (pBake->nDesc  != BAKED_NO_TEXT) ? pText + pBake->nDesc  : "";
+			pDesc->pDesc2    = (pBake->nDesc2 != BAKED_NO_TEXT) ? pText + pBake->nDesc2 : NULL;
+
+			pRoom->pRoomData = (const int16_t*)(pDecoder->map.pData + pBake->nTiles);
+			pRoom->pRoomDesc = pDesc;
+			pRoom->nRoomSize = pBake->nRoomSize;
+			pRoom->nRoomId   = pBake->nRoomId;
+			pRoom->nRoomX    = pBake->nRoomX;
+			pRoom->nRoomY    = pBake->nRoomY;
+		}
+
+		printf( "Loaded: %s (%d rooms, %d KB)\n", pDecoder->pMapFile, (int) pHeader->nRooms, (int)(pDecoder->map.nSize / K) );
+		return true;
+	}
+
+// Metrics ____________________________________________________________
+
+	// -perf: hardware counters of the thread that creates the decoder, read at stage boundaries.
+	// inherit = 1 so its rendering and deflate threads are counted once they are joined,
+	// other decoders running on other threads are not.
+	// ========================================
+	bool open_perf (Metrics_t *pMetrics)
+	{
+#if __linux__
+		const uint64_t aConfig[ NUM_PERF ] =
+		{
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_MISSES,
+			PERF_COUNT_HW_BRANCH_MISSES
+		};
+
+		int nOpened = 0;
+		for (int iCounter = 0; iCounter < NUM_PERF; ++iCounter)
+		{
+			struct perf_event_attr attr;
+			memset( &attr, 0, sizeof(attr) );
+			attr.size           = sizeof(attr);
+			attr.type           = PERF_TYPE_HARDWARE;
+			attr.config         = aConfig[ iCounter ];
+			attr.inherit        = 1;
+			attr.exclude_kernel = 1; // allowed at the default perf_event_paranoid = 2
+			attr.exclude_hv     = 1;
+
+			pMetrics->aPerfFd[ iCounter ] = (int) syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 ); // this thread, any CPU
+			if (pMetrics->aPerfFd[ iCounter ] >= 0)
+				nOpened++;
+		}
+
+		if (!nOpened)
+		{
+			printf( "WARNING: -perf: perf_event_open() failed (%s), no hardware counters\n", strerror( errno ) );
+			return false;
+		}
+		if (nOpened < NUM_PERF)
+			printf( "WARNING: -perf: only %d of %d hardware counters available\n", nOpened, NUM_PERF );
+		return true;
+#else
+		printf( "WARNING: -perf needs Linux perf_event_open(), ignored\n" );
+		return false;
+#endif
+	}
+
+	// Running totals since open_perf(), ~0 = counter not available
+	// ========================================
+	void read_perf (const Metrics_t *pMetrics, PerfCounters_t *pCounters)
+	{
+		for (int iCounter = 0; iCounter < NUM_PERF; ++iCounter)
+		{
+			pCounters->aCount[ iCounter ] = PERF_NONE;
+#if __linux__
+			uint64_t nCount;
+			if ((pMetrics->aPerfFd[ iCounter ] >= 0) && (read( pMetrics->aPerfFd[ iCounter ], &nCount, sizeof(nCount) ) == sizeof(nCount)))
+				pCounters->aCount[ iCounter ] = nCount;
+#endif
+		}
+	}
+
+	// ========================================
+	void diff_perf (PerfCounters_t *pDelta, const PerfCounters_t &start, const PerfCounters_t &end)
+	{
+		for (int iCounter = 0; iCounter < NUM_PERF; ++iCounter)
+			pDelta->aCount[ iCounter ] = ((start.aCount[ iCounter ] == PERF_NONE) || (end.aCount[ iCounter ] == PERF_NONE))
+				? PERF_NONE
+				: end.aCount[ iCounter ] - start.aCount[ iCounter ];
+	}
+
+	// ========================================
+	void close_perf (Metrics_t *pMetrics)
+	{
+#if __linux__
+		for (int iCounter = 0; iCounter < NUM_PERF; ++iCounter)
+			if (pMetrics->aPerfFd[ iCounter ] >= 0)
+				close( pMetrics->aPerfFd[ iCounter ] );
+#endif
+		for (int iCounter = 0; iCounter < NUM_PERF; ++iCounter)
+			pMetrics->aPerfFd[ iCounter ] = -1;
+	}
+
+	// ========================================
+	void begin_metrics (Decoder_t *pDecoder)
+	{
+		for (int iCounter = 0; iCounter < NUM_PERF; ++iCounter)
+			pDecoder->metrics.aPerfFd[ iCounter ] = -1;
+
+		if (pDecoder->options.bPerf)
+			pDecoder->options.bPerf = open_perf( &pDecoder->metrics );
+		if (pDecoder->options.bPerf)
+			read_perf( &pDecoder->metrics, &pDecoder->metrics.perfStage );
+
+		pDecoder->metrics.tStart = pDecoder->metrics.tStage = std::chrono::steady_clock::now();
+	}
+
+	// Closes the stage started by the previous end_stage() or begin_metrics(); returns its seconds
+	// ========================================
+	double end_stage (Decoder_t *pDecoder, const char *pName)
+	{
+		auto   tEnd  = std::chrono::steady_clock::now();
+		double nSecs = std::chrono::duration<double>( tEnd - pDecoder->metrics.tStage ).count();
+
+		PerfCounters_t perf;
+		if (pDecoder->options.bPerf)
+			read_perf( &pDecoder->metrics, &perf );
+
+		if (pDecoder->metrics.nStages < MAX_STAGE)
+		{
+			MetricsStage_t &stage = pDecoder->metrics.aStage[ pDecoder->metrics.nStages ];
+			stage.pName = pName;
+			stage.nSecs = nSecs;
+			if (pDecoder->options.bPerf)
+				diff_perf( &stage.perf, pDecoder->metrics.perfStage, perf );
+			pDecoder->metrics.nStages++;
+		}
+		pDecoder->metrics.tStage    = tEnd;
+		pDecoder->metrics.perfStage = perf;
+		return nSecs;
+	}
+
+	// Peak resident set size in KB, 0 if unknown
+	// ========================================
+	uint64_t get_peak_rss_kb ()
+	{
+#if _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof(counters) ))
+			return (uint64_t) counters.PeakWorkingSetSize / K;
+		return 0;
+#else
+		struct rusage usage;
+		if (getrusage( RUSAGE_SELF, &usage ) != 0)
+			return 0;
+	#if __APPLE__
+		return (uint64_t) usage.ru_maxrss / K; // bytes on macOS
+	#else
+		return (uint64_t) usage.ru_maxrss;     // KB on Linux
+	#endif
+#endif
+	}
+
+	// , "cycles": #, ... "ipc": # -- null for counters that aren't available
+	// ========================================
+	void write_perf_json (FILE *pFile, const PerfCounters_t &perf)
+	{
+		for (int iCounter = 0; iCounter < NUM_PERF; ++iCounter)
+		{
+			if (perf.aCount[ iCounter ] == PERF_NONE)
+				fprintf( pFile, ", \"%s\": null", gaPerfName[ iCounter ] );
+			else
+				fprintf( pFile, ", \"%s\": %llu", gaPerfName[ iCounter ], (unsigned long long) perf.aCount[ iCounter ] );
+		}
+
+		const uint64_t nCycles = perf.aCount[ PERF_CYCLES       ];
+		const uint64_t nInstr  = perf.aCount[ PERF_INSTRUCTIONS ];
+		if ((nCycles == PERF_NONE) || (nInstr == PERF_NONE) || !nCycles)
+			fprintf( pFile, ", \"ipc\": null" );
+		else
+			fprintf( pFile, ", \"ipc\": %.3f", (double) nInstr / (double) nCycles );
+	}
+
+	// "string" with backslashes and quotes escaped, e.g. a Windows -map path
+	// ========================================
+	void write_json_string (FILE *pFile, const char *pString)
+	{
+		fputc( '"', pFile );
+		for (const char *pSrc = pString; *pSrc; ++pSrc)
+		{
+			if ((*pSrc == '"') || (*pSrc == '\\'))
+				fputc( '\\', pFile );
+			fputc( *pSrc, pFile );
+		}
+		fputc( '"', pFile );
+	}
+
+	// ========================================
+	void write_metrics (Decoder_t *pDecoder)
+	{
+		const int nRooms = pDecoder->world.nRooms;
+
+		if (!pDecoder->options.pMetricsFile)
+			return;
+
+		FILE *pFile = fopen( pDecoder->options.pMetricsFile, "w" );
+		if (!pFile)
+		{
+			printf( "ERROR: Couldn't write: '%s'\n", pDecoder->options.pMetricsFile );
+			return;
+		}
+
+		const double nTotalSecs = std::chrono::duration<double>( std::chrono::steady_clock::now() - pDecoder->metrics.tStart ).count();
+		const int    nUsedTiles = count_used_tiles( pDecoder );
+
+		fprintf( pFile, "{\n" );
+		fprintf( pFile, "  \"map\": { \"file\": " );
+		write_json_string( pFile, pDecoder->pMapFile );
+		fprintf( pFile, ", \"bytes\": %llu, \"rooms\": %d, \"width\": %d, \"height\": %d },\n",
+			(unsigned long long) pDecoder->map.nSize, nRooms, pDecoder->world.nMapWidth, pDecoder->world.nMapHeight );
+		fprintf( pFile, "  \"options\": { \"threads\": %d, \"indexed\": %s, \"stream\": %s, \"mmap\": %s, \"bmp\": %d, \"png\": %s, \"dzi\": %s, \"incremental\": %s, \"baked\": %s },\n",
+			pDecoder->options.nThreads, pDecoder->options.bIndexed ? "true" : "false", pDecoder->options.bStream ? "true" : "false", pDecoder->options.bMapOutput ? "true" : "false", pDecoder->options.nBitmapBits,
+			pDecoder->options.bPNG ? "true" : "false", pDecoder->options.bDeepZoom ? "true" : "false", pDecoder->options.bIncremental ? "true" : "false", pDecoder->options.bBaked ? "true" : "false" );
+		fprintf( pFile, "  \"blitter\": \"%s\",\n", gBlitter.pName );
+
+		fprintf( pFile, "  \"stages\": [\n" );
+		for (int iStage = 0; iStage < pDecoder->metrics.nStages; ++iStage)
+		{
+			const MetricsStage_t &stage = pDecoder->metrics.aStage[ iStage ];
+			fprintf( pFile, "    { \"name\": \"%s\", \"seconds\": %.6f", stage.pName, stage.nSecs );
+			if (pDecoder->options.bPerf)
+				write_perf_json( pFile, stage.perf );
+			fprintf( pFile, " }%s\n", (iStage < pDecoder->metrics.nStages-1) ? "," : "" );
+		}
+		fprintf( pFile, "  ],\n" );
+
+		fprintf( pFile, "  \"seconds\": %.6f,\n", nTotalSecs );
+		fprintf( pFile, "  \"rooms_per_second\": %.1f,\n", (pDecoder->metrics.nRenderSecs > 0) ? nRooms / pDecoder->metrics.nRenderSecs : 0.0 );
+		fprintf( pFile, "  \"bytes_read\": %llu,\n"   , (unsigned long long) pDecoder->metrics.nBytesRead    );
+		fprintf( pFile, "  \"bytes_written\": %llu,\n", (unsigned long long) pDecoder->metrics.nBytesWritten );
+		fprintf( pFile, "  \"peak_rss_kb\": %llu,\n"  , (unsigned long long) get_peak_rss_kb()      );
+
+		// Same figures as dump_histogram(), only tiles that are used
+		fprintf( pFile, "  \"histogram\": {\n" );
+		fprintf( pFile, "    \"used_tiles\": %d,\n"  , nUsedTiles );
+		fprintf( pFile, "    \"unused_tiles\": %d,\n", NUM_TILE - nUsedTiles );
+		fprintf( pFile, "    \"total_tiles\": %d,\n" , NUM_TILE );
+		fprintf( pFile, "    \"efficiency\": %.4f,\n", 100.0 * (double)nUsedTiles / (double)NUM_TILE );
+		fprintf( pFile, "    \"tiles\": {" );
+		const char *pSeparator = "";
+		for (int i = 0; i < NUM_TILE; ++i)
+		{
+			if (!pDecoder->aHistogram[i])
+				continue;
+			fprintf( pFile, "%s\n      \"%04X\": %u", pSeparator, get_tile_id( i ), pDecoder->aHistogram[i] );
+			pSeparator = ",";
+		}
+		fprintf( pFile, "\n    }\n" );
+		fprintf( pFile, "  }\n" );
+		fprintf( pFile, "}\n" );
+		fclose( pFile );
+
+		if (!pDecoder->options.bQuiet)
+			printf( "Saved: %s\n", pDecoder->options.pMetricsFile );
+	}
+
+// Tile Stats _________________________________________________________
+
+	// -tiles: which atlas tiles every room uses, gathered in one pass over the rooms and written as JSON.
+	// Tiles are kept by dense index (see get_tile_index()) so a room's tile set is a NUM_TILE bit row.
+	const char TILES_FILE[] = "yhtwtg.tiles.json";
+	const int  TILE_WORDS   = NUM_TILE / 64; // uint64_t per room
+	static_assert( TILE_WORDS * 64 == NUM_TILE, "a room's tile set fills whole words" );
+
+	struct TileStats_t
+	{
+		int       nRooms;
+		int       nRoomWords;        // (nRooms + 63) / 64
+		uint64_t *aRoomTiles;        // [ nRooms ][ TILE_WORDS ] bit iIndex set = the room uses the tile
+		uint64_t *aTileRooms;        // [ NUM_TILE ][ nRoomWords ] the transpose: bit iRoom set = the tile is in the room
+		int       nUsed;
+		int       aUsed[ NUM_TILE ]; // dense indices of the used tiles, ascending
+		uint32_t *aCooccur;          // [ nUsed ][ nUsed ] rooms that use both tiles, the diagonal = rooms that use the tile
+	};
+
+	// Count one room's tiles and set its bit row, pBits can be NULL. Rooms of the wrong size are skipped, as prepare_room() does.
+	// ========================================
+	void count_room_tiles (const Decoder_t *pDecoder, const int iRoom, uint32_t *pHistogram, uint64_t *pBits)
+	{
+		const Room_t *pRoom = &pDecoder->aRooms[ iRoom ];
+		if (pRoom->nRoomSize != ROOM1C_Z)
+			return;
+
+		const int16_t *pSrc = pRoom->pRoomData;
+		for (int iTile = 0; iTile < ROOM1C_Z; ++iTile)
+		{
+			const int iIndex = get_tile_index( pSrc[ iTile ] );
+			if (iIndex < 0)
+				continue;
+
+			pHistogram[ iIndex ]++;
+			if (pBits)
+				pBits[ iIndex / 64 ] |= 1ull << (iIndex % 64);
+		}
+	}
+
+	// Fills the decoder's histogram with the same counts as rendering every room would
+	// ========================================
+	void analyze_tiles (Decoder_t *pDecoder, TileStats_t *pStats)
+	{
+		const int nRooms = pDecoder->world.nRooms;
+		const int nWords = (nRooms + 63) / 64;
+
+		memset( pStats, 0, sizeof(*pStats) );
+		pStats->nRooms     = nRooms;
+		pStats->nRoomWords = nWords;
+		pStats->aRoomTiles = new uint64_t[ nRooms * TILE_WORDS ](); // () = zero initialize
+		pStats->aTileRooms = new uint64_t[ NUM_TILE * nWords ]();
+
+		// Every room owns its bit row. Every worker counts tiles in a private histogram which is merged afterwards.
+		int nThreads = get_thread_count( pDecoder );
+		if (nThreads > nRooms) nThreads = nRooms;
+		if (nThreads < 1     ) nThreads = 1;
+
+		uint32_t *aHistogram = new uint32_t[ nThreads * HISTOGRAM_SIZE ](); // () = zero initialize
+
+		run_workers( nThreads, nRooms, [pDecoder, pStats, aHistogram]( const int iRoom, const int iWorker )
+		{
+			count_room_tiles( pDecoder, iRoom, aHistogram + iWorker*HISTOGRAM_SIZE, pStats->aRoomTiles + iRoom*TILE_WORDS );
+		});
+
+		memset( pDecoder->aHistogram, 0, sizeof(pDecoder->aHistogram) );
+		for (int iThread = 0; iThread < nThreads; ++iThread)
+		{
+			uint32_t *pHistogram = aHistogram + iThread*HISTOGRAM_SIZE;
+			for (int iTile = 0; iTile < HISTOGRAM_SIZE; ++iTile)
+				pDecoder->aHistogram[ iTile ] += pHistogram[ iTile ];
+		}
+
+		delete [] aHistogram;
+
+		// Transpose, so "which rooms use tile X" is one bit row too
+		for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+		{
+			const uint64_t *pBits = pStats->aRoomTiles + iRoom*TILE_WORDS;
+			for (int iWord = 0; iWord < TILE_WORDS; ++iWord)
+				for (uint64_t nBits = pBits[ iWord ]; nBits; nBits &= nBits - 1)
+				{
+					const int iIndex = iWord*64 + count_bits( (nBits & (0 - nBits)) - 1 ); // lowest set bit
+					pStats->aTileRooms[ iIndex*nWords + iRoom/64 ] |= 1ull << (iRoom % 64);
+				}
+		}
+
+		for (int iIndex = 0; iIndex < NUM_TILE; ++iIndex)
+			if (pDecoder->aHistogram[ iIndex ])
+				pStats->aUsed[ pStats->nUsed++ ] = iIndex;
+
+		// Co-occurrence: rooms in both tiles' room rows. Symmetric, only the upper half is counted.
+		const int nUsed = pStats->nUsed;
+		pStats->aCooccur = new uint32_t[ nUsed * nUsed ];
+		for (int iUsedA = 0; iUsedA < nUsed; ++iUsedA)
+		{
+			const uint64_t *pRoomsA = pStats->aTileRooms + pStats->aUsed[ iUsedA ]*nWords;
+			for (int iUsedB = iUsedA; iUsedB < nUsed; ++iUsedB)
+			{
+				const uint64_t *pRoomsB = pStats->aTileRooms + pStats->aUsed[ iUsedB ]*nWords;
+
+				uint32_t nBoth = 0;
+				for (int iWord = 0; iWord < nWords; ++iWord)
+					nBoth += count_bits( pRoomsA[ iWord ] & pRoomsB[ iWord ] );
+
+				pStats->aCooccur[ iUsedA*nUsed + iUsedB ] = nBoth;
+				pStats->aCooccur[ iUsedB*nUsed + iUsedA ] = nBoth;
+			}
+		}
+	}
+
+	// ========================================
+	void free_tile_stats (TileStats_t *pStats)
+	{
+		delete [] pStats->aRoomTiles;
+		delete [] pStats->aTileRooms;
+		delete [] pStats->aCooccur;
+		memset( pStats, 0, sizeof(*pStats) );
+	}
+
+	// "0000", "0103", ... the tiles of a room's bit row
+	// ========================================
+	void write_tile_list_json (FILE *pFile, const uint64_t *pBits)
+	{
+		const char *pSeparator = "";
+		for (int iIndex = 0; iIndex < NUM_TILE; ++iIndex)
+		{
+			if (!((pBits[ iIndex / 64 ] >> (iIndex % 64)) & 1))
+				continue;
+			fprintf( pFile, "%s\"%04X\"", pSeparator, get_tile_id( iIndex ) );
+			pSeparator = ", ";
+		}
+	}
+
+	//   tiles       : every used tile, how often it is drawn and which rooms use it
+	//   rooms       : every room's tile set
+	//   cooccurrence: [ tile, tile, rooms that use both ] for every pair of used tiles that share a room
+	// ========================================
+	void write_tile_stats_json (Decoder_t *pDecoder, const TileStats_t &stats)
+	{
+		char sFileName[ MAX_FILE_NAME ];
+		sprintf( sFileName, "%s%s", pDecoder->sOutputDir, TILES_FILE );
+
+		FILE *pFile = fopen( sFileName, "w" );
+		if (!pFile)
+		{
+			printf( "ERROR: Couldn't write: '%s'\n", sFileName );
+			return;
+		}
+
+		fprintf( pFile, "{\n" );
+		fprintf( pFile, "  \"map\": " );
+		write_json_string( pFile, pDecoder->pMapFile );
+		fprintf( pFile, ",\n" );
+		fprintf( pFile, "  \"atlas_tiles\": %d,\n", NUM_TILE );
+		fprintf( pFile, "  \"used_tiles\": %d,\n", stats.nUsed );
+
+		fprintf( pFile, "  \"tiles\": [\n" );
+		for (int iUsed = 0; iUsed < stats.nUsed; ++iUsed)
+		{
+			const int       iIndex = stats.aUsed[ iUsed ];
+			const uint64_t *pRooms = stats.aTileRooms + iIndex*stats.nRoomWords;
+
+			fprintf( pFile, "    { \"tile\": \"%04X\", \"count\": %u, \"rooms\": [", get_tile_id( iIndex ), pDecoder->aHistogram[ iIndex ] );
+			const char *pSeparator = "";
+			for (int iRoom = 0; iRoom < stats.nRooms; ++iRoom)
+			{
+				if (!((pRooms[ iRoom / 64 ] >> (iRoom % 64)) & 1))
+					continue;
+				fprintf( pFile, "%s%d", pSeparator, iRoom );
+				pSeparator = ", ";
+			}
+			fprintf( pFile, "] }%s\n", (iUsed < stats.nUsed-1) ? "," : "" );
+		}
+		fprintf( pFile, "  ],\n" );
+
+		fprintf( pFile, "  \"rooms\": [\n" );
+		for (int iRoom = 0; iRoom < stats.nRooms; ++iRoom)
+		{
+			const Room_t *pRoom = &pDecoder->aRooms[ iRoom ];
+			fprintf( pFile, "    { \"room\": %d, \"x\": %d, \"y\": %d, \"title\": ", iRoom, pRoom->nRoomX, pRoom->nRoomY );
+			write_json_string( pFile, pRoom->pRoomDesc->pDesc ? pRoom->pRoomDesc->pDesc : "" );
+			fprintf( pFile, ", \"tiles\": [" );
+			write_tile_list_json( pFile, stats.aRoomTiles + iRoom*TILE_WORDS );
+			fprintf( pFile, "] }%s\n", (iRoom < stats.nRooms-1) ? "," : "" );
+		}
+		fprintf( pFile, "  ],\n" );
+
+		fprintf( pFile, "  \"cooccurrence\": [" );
+		const char *pSeparator = "";
+		for (int iUsedA = 0; iUsedA < stats.nUsed; ++iUsedA)
+			for (int iUsedB = iUsedA+1; iUsedB < stats.nUsed; ++iUsedB)
+			{
+				const uint32_t nBoth = stats.aCooccur[ iUsedA*stats.nUsed + iUsedB ];
+				if (!nBoth)
+					continue;
+				fprintf( pFile, "%s\n    [\"%04X\", \"%04X\", %u]", pSeparator, get_tile_id( stats.aUsed[ iUsedA ] ), get_tile_id( stats.aUsed[ iUsedB ] ), nBoth );
+				pSeparator = ",";
+			}
+		fprintf( pFile, "\n  ]\n" );
+		fprintf( pFile, "}\n" );
+
+		pDecoder->metrics.nBytesWritten += (uint64_t) ftell( pFile );
+		fclose( pFile );
+
+		if (!pDecoder->options.bQuiet)
+			printf( "Saved: %s\n", sFileName );
+	}
+
+	// ========================================
+	void write_tile_stats (Decoder_t *pDecoder)
+	{
+		TileStats_t stats;
+		analyze_tiles( pDecoder, &stats );
+		end_stage( pDecoder, "analyze_tiles" );
+
+		dump_histogram( pDecoder );
+		write_tile_stats_json( pDecoder, stats );
+		end_stage( pDecoder, "write_tile_stats" );
+
+		free_tile_stats( &stats );
+		write_metrics( pDecoder );
+	}
+
+	// -repack: a baked world whose atlas only holds the used tiles, most drawn first, with the rooms' tiles
+	// renumbered to match. Hot tiles share cache lines and the atlas rows past the used tiles are never read.
+	// The compact atlas is also written on its own, as .data and indexed .png, for the web viewer.
+	const char REPACKED_FILE[] = "yhtwtg_repacked.baked";
+
+	// ========================================
+	void write_repacked (Decoder_t *pDecoder)
+	{
+		const int nRooms = pDecoder->world.nRooms;
+
+		memset( pDecoder->aHistogram, 0, sizeof(pDecoder->aHistogram) );
+		for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+			count_room_tiles( pDecoder, iRoom, pDecoder->aHistogram, NULL );
+
+		// Used tiles by count, ties keep their atlas order
+		int aOrder[ NUM_TILE ];
+		int nUsed = 0;
+		for (int iIndex = 0; iIndex < NUM_TILE; ++iIndex)
+			if (pDecoder->aHistogram[ iIndex ])
+				aOrder[ nUsed++ ] = iIndex;
+
+		if (!nUsed)
+		{
+			printf( "ERROR: No atlas tiles are used, nothing to repack\n" );
+			return;
+		}
+
+		std::stable_sort( aOrder, aOrder + nUsed, [pDecoder]( const int iA, const int iB )
+		{
+			return pDecoder->aHistogram[ iA ] > pDecoder->aHistogram[ iB ];
+		});
+
+		int aRemap[ NUM_TILE ];
+		for (int iIndex = 0; iIndex < NUM_TILE; ++iIndex)
+			aRemap[ iIndex ] = iIndex; // only rooms of the wrong size, which aren't drawn, can still use an unused tile
+
+		uint32_t *aRGBA    = new uint32_t[ TILE_Z * NUM_TILE ](); // () = zero initialize
+		uint32_t *aBGRA    = new uint32_t[ TILE_Z * NUM_TILE ]();
+		uint8_t  *aIndexed = new uint8_t [ TILE_Z * NUM_TILE ]();
+
+		for (int iNew = 0; iNew < nUsed; ++iNew)
+		{
+			const int iOld = aOrder[ iNew ];
+			const int nSrc = get_tile_offset( (int16_t) get_tile_id( iOld ), 0, 0 );
+			const int nDst = get_tile_offset( (int16_t) get_tile_id( iNew ), 0, 0 );
+
+			aRemap[ iOld ] = iNew;
+			for (int y = 0; y < TILE_H; ++y)
+			{
+				memcpy( aRGBA    + nDst + y*ATLAS_IMAGE_W, pDecoder->assets.pTilesRGBA    + nSrc + y*ATLAS_IMAGE_W, TILE_W * sizeof(uint32_t) );
+				memcpy( aBGRA    + nDst + y*ATLAS_IMAGE_W, pDecoder->assets.pTilesBGRA    + nSrc + y*ATLAS_IMAGE_W, TILE_W * sizeof(uint32_t) );
+				memcpy( aIndexed + nDst + y*ATLAS_IMAGE_W, pDecoder->assets.pTilesIndexed + nSrc + y*ATLAS_IMAGE_W, TILE_W );
+			}
+		}
+
+		Assets_t assets      = pDecoder->assets; // same font
+		assets.pTilesRGBA    = aRGBA;
+		assets.pTilesBGRA    = aBGRA;
+		assets.pTilesIndexed = aIndexed;
+
+		char sFileName[ MAX_FILE_NAME ];
+		sprintf( sFileName, "%s%s", pDecoder->sOutputDir, REPACKED_FILE );
+		bake_world( pDecoder, sFileName, assets, aRemap );
+
+		// Compact atlas: only the tile rows in use
+		const int nRows   = (nUsed + ATLAS_W - 1) / ATLAS_W;
+		const int nHeight = nRows * TILE_H;
+
+		sprintf( sFileName, "%stiles_repacked_%dx%d_rgba32_%dx%d.data", pDecoder->sOutputDir, ATLAS_W, nRows, ATLAS_IMAGE_W, nHeight );
+		save_file( pDecoder, sFileName, aRGBA, sizeof(uint32_t) * ATLAS_IMAGE_W * nHeight );
+
+		Surface8_t atlas;
+		map_surface( &atlas, aIndexed, 1, 1, ATLAS_IMAGE_W, nHeight, false );
+		sprintf( sFileName, "%stiles_repacked_%dx%d.png", pDecoder->sOutputDir, ATLAS_W, nRows );
+		size_t nSize = write_png( pDecoder, sFileName, atlas, 1 );
+		if (nSize && !pDecoder->options.bQuiet)
+			printf( "Saved: %s (%d KB)\n", sFileName, (int)(nSize / K) );
+
+		printf( "Repacked: %d of %d tiles, atlas %d x %d -> %d x %d px\n", nUsed, NUM_TILE, ATLAS_IMAGE_W, ATLAS_IMAGE_H, ATLAS_IMAGE_W, nHeight );
+
+		delete [] aRGBA;
+		delete [] aBGRA;
+		delete [] aIndexed;
+
+		end_stage( pDecoder, "write_repacked" );
+		write_metrics( pDecoder );
+	}
+
+// Room Similarity ____________________________________________________
+
+	// -similar: rooms that are nearly the same, or the same moved by a few tiles, written as JSON with the
+	// dedup map of exact duplicates (see dedup_rooms()).
+	// Every FINGERPRINT_TILES square of tiles in a room is hashed by rolling down each column, then across the
+	// column hashes. Rooms that share a fingerprint vote for the offset between the two squares and only offsets
+	// with MIN_VOTES are compared tile by tile, so rooms are never compared pairwise.
+	// Rooms are mostly backdrop, so only the other tiles count: similarity = equal / tiles in either room.
+	const char     SIMILAR_FILE[]    = "yhtwtg.similar.json";
+	const int      FINGERPRINT_TILES = 6;
+	const int      FINGERPRINT_W     = ROOM1C_W - FINGERPRINT_TILES + 1; // squares per room row
+	const int      FINGERPRINT_H     = ROOM1C_H - FINGERPRINT_TILES + 1; // squares per room column
+	const uint64_t ROLL_BASE_X       = 0xC2B2AE3D27D4EB4Full; // odd, across the column hashes
+	const int      MAX_BUCKET        = 16;  // a square found in more places (sky, plain wall) says nothing about a pair of rooms
+	const int      MIN_VOTES         = 4;
+	const double   SIMILAR_MIN       = 0.5;
+
+	struct Fingerprint_t
+	{
+		uint64_t nHash;
+		int32_t  iRoom;
+		int16_t  nX; // tiles, top-left of the square
+		int16_t  nY;
+	};
+
+	// Room B's tile at x,y is room A's tile at x - nDX, y - nDY for nEqual of the nTiles that aren't backdrop in either
+	struct SimilarRooms_t
+	{
+		int iRoomA;
+		int iRoomB;
+		int nDX;
+		int nDY;
+		int nEqual;
+		int nTiles;
+	};
+
+	// ========================================
+	int fingerprint_room (const Decoder_t *pDecoder, const int iRoom, Fingerprint_t *pPrint)
+	{
+		const int16_t *pTiles  = pDecoder->aRooms[ iRoom ].pRoomData; // column-major: tile x,y = pTiles[ x*ROOM1C_H + y ]
+		const uint64_t nPowerY = roll_power( ROLL_BASE  , FINGERPRINT_TILES );
+		const uint64_t nPowerX = roll_power( ROLL_BASE_X, FINGERPRINT_TILES );
+
+		uint64_t aColumn[ FINGERPRINT_H ][ ROOM1C_W ]; // hash of FINGERPRINT_TILES tiles of column x from y down
+		for (int x = 0; x < ROOM1C_W; ++x)
+		{
+			const int16_t *pColumn = pTiles + x*ROOM1C_H;
+
+			uint64_t nHash = roll_hash( pColumn, FINGERPRINT_TILES, 1 );
+			aColumn[ 0 ][ x ] = nHash;
+			for (int y = 1; y < FINGERPRINT_H; ++y)
+			{
+				nHash = nHash*ROLL_BASE - ((uint16_t) pColumn[ y-1 ] + 1)*nPowerY + (uint16_t) pColumn[ y+FINGERPRINT_TILES-1 ] + 1;
+				aColumn[ y ][ x ] = nHash;
+			}
+		}
+
+		int nPrints = 0;
+		for (int y = 0; y < FINGERPRINT_H; ++y)
+		{
+			uint64_t nHash = 0;
+			for (int x = 0; x < ROOM1C_W; ++x)
+			{
+				nHash = nHash*ROLL_BASE_X + aColumn[ y ][ x ];
+				if (x >= FINGERPRINT_TILES)
+					nHash -= aColumn[ y ][ x-FINGERPRINT_TILES ]*nPowerX;
+				if (x < FINGERPRINT_TILES-1)
+					continue;
+
+				Fingerprint_t *pOut = &pPrint[ nPrints++ ];
+				pOut->nHash = nHash;
+				pOut->iRoom = iRoom;
+				pOut->nX    = (int16_t)(x - FINGERPRINT_TILES + 1);
+				pOut->nY    = (int16_t) y;
+			}
+		}
+		return nPrints;
+	}
+
+	// The room's most used tile: the backdrop the rest is drawn on
+	// ========================================
+	int16_t get_backdrop_tile (const int16_t *pTiles)
+	{
+		int aCount[ NUM_TILE ] = {};
+		int iBest = 0;
+		for (int iTile = 0; iTile < ROOM1C_Z; ++iTile)
+		{
+			const int iIndex = get_tile_index( pTiles[ iTile ] );
+			if ((iIndex >= 0) && (++aCount[ iIndex ] > aCount[ iBest ]))
+				iBest = iIndex;
+		}
+		return (int16_t) get_tile_id( iBest );
+	}
+
+	// ========================================
+	int count_content_tiles (const int16_t *pTiles, const int16_t iBackdrop)
+	{
+		int nContent = 0;
+		for (int iTile = 0; iTile < ROOM1C_Z; ++iTile)
+			nContent += (pTiles[ iTile ] != iBackdrop);
+		return nContent;
+	}
+
+	// Tiles of room B, other than its backdrop, that equal room A's moved by nDX, nDY
+	// ========================================
+	int count_equal_tiles (const int16_t *pTilesA, const int16_t *pTilesB, const int nDX, const int nDY, const int16_t iBackdropB)
+	{
+		const int nX0 = (nDX > 0) ? nDX : 0, nX1 = (nDX < 0) ? ROOM1C_W + nDX : ROOM1C_W;
+		const int nY0 = (nDY > 0) ? nDY : 0, nY1 = (nDY < 0) ? ROOM1C_H + nDY : ROOM1C_H;
+
+		int nEqual = 0;
+		for (int x = nX0; x < nX1; ++x)
+			for (int y = nY0; y < nY1; ++y)
+			{
+				const int16_t iTile = pTilesB[ x*ROOM1C_H + y ];
+				nEqual += (iTile == pTilesA[ (x - nDX)*ROOM1C_H + (y - nDY) ]) && (iTile != iBackdropB);
+			}
+		return nEqual;
+	}
+
+	// ========================================
+	double get_similarity (const SimilarRooms_t &similar)
+	{
+		return similar.nTiles ? (double) similar.nEqual / similar.nTiles : 0.0;
+	}
+
+	// Near duplicates (nDX = nDY = 0) and shifted copies of the unique rooms, most equal tiles first.
+	// Returns how many, *ppSimilar is for delete []
+	// ========================================
+	int find_similar_rooms (const Decoder_t *pDecoder, SimilarRooms_t **ppSimilar)
+	{
+		const int nRooms = pDecoder->world.nRooms;
+
+		int16_t *aBackdrop = new int16_t[ nRooms ]();
+		int     *aContent  = new int    [ nRooms ](); // tiles that aren't the backdrop
+		for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+		{
+			const Room_t *pRoom = &pDecoder->aRooms[ iRoom ];
+			if (pRoom->nRoomSize != ROOM1C_Z)
+				continue;
+			aBackdrop[ iRoom ] = get_backdrop_tile( pRoom->pRoomData );
+			aContent [ iRoom ] = count_content_tiles( pRoom->pRoomData, aBackdrop[ iRoom ] );
+		}
+
+		// Exact duplicates already draw as copies, only the rooms they copy take part
+		Fingerprint_t *aPrint  = new Fingerprint_t[ (size_t) nRooms * FINGERPRINT_W * FINGERPRINT_H ];
+		int            nPrints = 0;
+		for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+			if ((pDecoder->aRooms[ iRoom ].nRoomSize == ROOM1C_Z) && (pDecoder->aRoomDedup[ iRoom ] == iRoom))
+				nPrints += fingerprint_room( pDecoder, iRoom, aPrint + nPrints );
+
+		std::sort( aPrint, aPrint + nPrints, []( const Fingerprint_t &a, const Fingerprint_t &b )
+		{
+			return (a.nHash != b.nHash) ? (a.nHash < b.nHash) : (a.iRoom < b.iRoom);
+		});
+
+		// Every pair of squares with the same hash in two rooms is a vote: room A, room B, offset
+		size_t nVotes = 0;
+		for (int iStart = 0, iEnd = 0; iStart < nPrints; iStart = iEnd)
+		{
+			for (iEnd = iStart + 1; (iEnd < nPrints) && (aPrint[ iEnd ].nHash == aPrint[ iStart ].nHash); ++iEnd)
+				;
+			const size_t nSame = iEnd - iStart;
+			if ((nSame >= 2) && (nSame <= MAX_BUCKET))
+				nVotes += nSame * (nSame - 1) / 2;
+		}
+
+		uint64_t *aVote = new uint64_t[ nVotes + 1 ];
+		nVotes = 0;
+		for (int iStart = 0, iEnd = 0; iStart < nPrints; iStart = iEnd)
+		{
+			for (iEnd = iStart + 1; (iEnd < nPrints) && (aPrint[ iEnd ].nHash == aPrint[ iStart ].nHash); ++iEnd)
+				;
+			if (iEnd - iStart > MAX_BUCKET)
+				continue;
+
+			for (int iA = iStart; iA < iEnd; ++iA)
+				for (int iB = iA + 1; iB < iEnd; ++iB)
+				{
+					const Fingerprint_t &a = aPrint[ iA ]; // sorted by room, a.iRoom <= b.iRoom
+					const Fingerprint_t &b = aPrint[ iB ];
+					if (a.iRoom == b.iRoom)
+						continue;
+
+					aVote[ nVotes++ ] = ((uint64_t) a.iRoom << 36) | ((uint64_t) b.iRoom << 16)
+					                  | ((uint64_t)(b.nX - a.nX + 128) << 8) | (uint64_t)(b.nY - a.nY + 128);
+				}
+		}
+		delete [] aPrint;
+
+		std::sort( aVote, aVote + nVotes );
+
+		// Best offset of every pair of rooms, by equal tiles
+		SimilarRooms_t *aSimilar = new SimilarRooms_t[ nVotes / MIN_VOTES + 1 ];
+		int             nSimilar = 0;
+		SimilarRooms_t  best     = { -1, -1, 0, 0, 0, 0 };
+
+		for (size_t iStart = 0, iEnd = 0; iStart < nVotes; iStart = iEnd)
+		{
+			for (iEnd = iStart + 1; (iEnd < nVotes) && (aVote[ iEnd ] == aVote[ iStart ]); ++iEnd)
+				;
+
+			const int iRoomA = (int)(aVote[ iStart ] >> 36);
+			const int iRoomB = (int)(aVote[ iStart ] >> 16) & 0xFFFFF;
+			if ((iRoomA != best.iRoomA) || (iRoomB != best.iRoomB))
+			{
+				if (get_similarity( best ) >= SIMILAR_MIN)
+					aSimilar[ nSimilar++ ] = best;
+				best = { iRoomA, iRoomB, 0, 0, 0, 0 };
+			}
+
+			if (iEnd - iStart < (size_t) MIN_VOTES)
+				continue;
+
+			const int nDX    = (int)((aVote[ iStart ] >> 8) & 0xFF) - 128;
+			const int nDY    = (int)((aVote[ iStart ] >> 0) & 0xFF) - 128;
+			const int nEqual = count_equal_tiles( pDecoder->aRooms[ iRoomA ].pRoomData, pDecoder->aRooms[ iRoomB ].pRoomData, nDX, nDY, aBackdrop[ iRoomB ] );
+			if (nEqual > best.nEqual)
+				best = { iRoomA, iRoomB, nDX, nDY, nEqual, aContent[ iRoomA ] + aContent[ iRoomB ] - nEqual };
+		}
+		if (get_similarity( best ) >= SIMILAR_MIN)
+			aSimilar[ nSimilar++ ] = best;
+		delete [] aVote;
+		delete [] aBackdrop;
+		delete [] aContent;
+
+		std::stable_sort( aSimilar, aSimilar + nSimilar, []( const SimilarRooms_t &a, const SimilarRooms_t &b )
+		{
+			return get_similarity( a ) > get_similarity( b );
+		});
+
+		*ppSimilar = aSimilar;
+		return nSimilar;
+	}
+
+	// ========================================
+	void write_similar_json (Decoder_t *pDecoder, const SimilarRooms_t *aSimilar, const int nSimilar, const int nUnique)
+	{
+		const int nRooms = pDecoder->world.nRooms;
+
+		char sFileName[ MAX_FILE_NAME ];
+		sprintf( sFileName, "%s%s", pDecoder->sOutputDir, SIMILAR_FILE );
+
+		FILE *pFile = fopen( sFileName, "w" );
+		if (!pFile)
+		{
+			printf( "ERROR: Couldn't write: '%s'\n", sFileName );
+			return;
+		}
+
+		fprintf( pFile, "{\n" );
+		fprintf( pFile, "  \"map\": " );
+		write_json_string( pFile, pDecoder->pMapFile );
+		fprintf( pFile, ",\n" );
+		fprintf( pFile, "  \"rooms\": %d,\n", nRooms );
+		fprintf( pFile, "  \"unique_rooms\": %d,\n", nUnique );
+
+		// Per room the room with the same tiles that is drawn first, itself if none
+		fprintf( pFile, "  \"dedup\": [" );
+		for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+			fprintf( pFile, "%s%d", iRoom ? ", " : "", pDecoder->aRoomDedup[ iRoom ] );
+		fprintf( pFile, "],\n" );
+
+		// room_b's tile at x,y is room_a's tile at x - dx, y - dy for equal_tiles of the tiles that aren't backdrop in either room
+		fprintf( pFile, "  \"similar\": [" );
+		for (int iSimilar = 0; iSimilar < nSimilar; ++iSimilar)
+		{
+			const SimilarRooms_t &similar = aSimilar[ iSimilar ];
+			const char           *pTitleA = pDecoder->aRooms[ similar.iRoomA ].pRoomDesc->pDesc;
+			const char           *pTitleB = pDecoder->aRooms[ similar.iRoomB ].pRoomDesc->pDesc;
+
+			fprintf( pFile, "%s\n    { \"room_a\": %d, \"room_b\": %d, \"dx\": %d, \"dy\": %d, \"equal_tiles\": %d, \"tiles\": %d, \"similarity\": %.4f, \"titles\": [",
+				iSimilar ? "," : "", similar.iRoomA, similar.iRoomB, similar.nDX, similar.nDY, similar.nEqual, similar.nTiles, get_similarity( similar ) );
+			write_json_string( pFile, pTitleA ? pTitleA : "" );
+			fprintf( pFile, ", " );
+			write_json_string( pFile, pTitleB ? pTitleB : "" );
+			fprintf( pFile, "] }" );
+		}
+		fprintf( pFile, "\n  ]\n" );
+		fprintf( pFile, "}\n" );
+
+		pDecoder->metrics.nBytesWritten += (uint64_t) ftell( pFile );
+		fclose( pFile );
+
+		if (!pDecoder->options.bQuiet)
+			printf( "Saved: %s\n", sFileName );
+	}
+
+	// ========================================
+	void write_similar_rooms (Decoder_t *pDecoder)
+	{
+		const int nRooms = pDecoder->world.nRooms;
 
-		printf( "@ %06X Room #%3d (%+3d x %+3d), Size: %d, %s\n",
-			(int)(pSrc - pMap)*2, pRoom->nRoomId, pRoom->nRoomX, pRoom->nRoomY, pRoom->nRoomSize, pRoom->pRoomDesc->pDesc );
-		pSrc += 4 + ROOM1C_Z;
-		pRoom++;
+		SimilarRooms_t *aSimilar = NULL;
+		const int       nSimilar = find_similar_rooms( pDecoder, &aSimilar );
+		end_stage( pDecoder, "find_similar_rooms" );
+
+		int nUnique = 0;
+		for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+			if (pDecoder->aRoomDedup[ iRoom ] == iRoom)
+				nUnique++;
+
+		int nShifted = 0;
+		for (int iSimilar = 0; iSimilar < nSimilar; ++iSimilar)
+		{
+			const SimilarRooms_t &similar = aSimilar[ iSimilar ];
+			if (similar.nDX || similar.nDY)
+				nShifted++;
+
+			if (!pDecoder->options.bQuiet)
+				printf( "Similar: #%3d ~ #%3d  dx %+3d dy %+3d  %5.1f%%  %s ~ %s\n", similar.iRoomA, similar.iRoomB, similar.nDX, similar.nDY,
+					100.0 * get_similarity( similar ), pDecoder->aRooms[ similar.iRoomA ].pRoomDesc->pDesc, pDecoder->aRooms[ similar.iRoomB ].pRoomDesc->pDesc );
+		}
+
+		printf( "Rooms: %d, unique: %d, near duplicates: %d, shifted copies: %d\n", nRooms, nUnique, nSimilar - nShifted, nShifted );
+
+		write_similar_json( pDecoder, aSimilar, nSimilar, nUnique );
+		delete [] aSimilar;
+
+		end_stage( pDecoder, "write_similar" );
+		write_metrics( pDecoder );
 	}
 
-	// NOTE: Unknown trailing map data
-	int offset = (int)(pSrc - pMap)*2;
-	int slack =  (int)(gSize - offset);
-	printf( "@ %06X Unknown map data: %d (0x%04X) bytes\n", offset, slack, slack );
+// Streaming __________________________________________________________
 
-	return iRoom;
-};
+	// Bands in flight between the renderer and the writer
+	const int STREAM_RING = 2;
 
-// ========================================
-void draw_1D_room (const int iRoom, const int nNextRoomY )
-{
-	int16_t  iTile;
-	Room_t  *pRoom = &gRooms[ iRoom ];
-	int16_t *pSrc = pRoom->pRoomData;
-#ifdef TUTORIAL // temp disable to dump raw rooms
-  #if TUTORIAL < 3
-    pSrc = (int16_t*)(gRawMap + iRoom*ROOM1C_Z);
-  #else // assume 30 byte map header, room has no header
-    pSrc = (int16_t*)(gRawMap + sizeof(MapHeader_t) + 8 + iRoom*ROOM1C_Z);
-    // 22 byte header, each room has an 8 byte header
-  #endif
-#else
-	if (pRoom->nRoomSize != ROOM1C_Z)
+	typedef void (*DrawBand_t)(const Decoder_t *pDecoder, Surface8_t *pBand, const int iBand, uint32_t *pHistogram);
+
+	// One world row of rooms with their names, i.e. 6080 x 200 px
+	// ========================================
+	void draw_band_2D (const Decoder_t *pDecoder, Surface8_t *pBand, const int iBand, uint32_t *pHistogram)
 	{
-		printf( "ERROR: Room size != %d tiles\n", ROOM1C_Z );
-		return;
+		memset( pBand->pPixels, INDEX_TRANSPARENT, pBand->nSize );
+
+		for (int iRoom = 0; iRoom < pDecoder->world.nRooms; ++iRoom)
+		{
+			if (pDecoder->aRooms[ iRoom ].nRoomY - pDecoder->world.nMinRoomY != iBand)
+				continue;
+
+			int nRoomX = pDecoder->aRooms[ iRoom ].nRoomX - pDecoder->world.nMinRoomX;
+			draw_room_2D( pDecoder, pBand, iRoom, nRoomX * ROOM2D_W_PX, 0, pHistogram );
+		}
 	}
-#endif
 
-#ifdef TUTORIAL
-  #if TUTORIAL == 1
-	for (int y = 0; y < ROOM1C_H; y++)
+	// One room of the single column World Map, 320 x 192 px
+	// ========================================
+	void draw_band_1D (const Decoder_t *pDecoder, Surface8_t *pBand, const int iBand, uint32_t *pHistogram)
 	{
-		for (int x = 0; x < ROOM1C_W; x++)
-		{
-  #else
-	for (int x = 0; x < ROOM1C_W; x++)
+		draw_room( pDecoder, pBand, iBand, 0, 0, pHistogram );
+	}
+
+	// Render a World Map one band of rooms at a time into a small ring of 8-bpp buffers.
+	// A writer thread expands band N to 32-bpp and writes it to the raw .data (top-down)
+	// and/or .BMP (bottom-up, seeked into place) while band N+1 is being drawn.
+	// Peak memory is STREAM_RING indexed bands + one 32-bpp band regardless of world size.
+	// ========================================
+	void stream_map (Decoder_t *pDecoder, const char *pDataName, const char *pBitmapName, const int nBitmapBits, const int nRoomsW, const int nBands, const int nRoomW_px, const int nRoomH_px, DrawBand_t pDrawBand, uint32_t *pHistogram)
 	{
-		for (int y = 0; y < ROOM1C_H; y++)
+		FILE *pData   = pDataName   ? fopen( pDataName  , "w+b" ) : NULL;
+		FILE *pBitmap = pBitmapName ? fopen( pBitmapName, "w+b" ) : NULL;
+
+		if ((pDataName && !pData) || (pBitmapName && !pBitmap))
 		{
-  #endif
-#else
-	for (int x = 0; x < ROOM1C_W; x++)
+			printf( "ERROR: Couldn't write: '%s'\n", (pDataName && !pData) ? pDataName : pBitmapName );
+			if (pData  ) fclose( pData   );
+			if (pBitmap) fclose( pBitmap );
+			return;
+		}
+
+		const int    nWidth     = nRoomsW * nRoomW_px;
+		const int    nHeight    = nBands  * nRoomH_px;
+		const size_t nBandBytes = 4 * (size_t)nWidth * nRoomH_px;
+		const size_t nBMPPitch  = get_bitmap_pitch( nWidth, nBitmapBits );
+		const size_t nBMPBytes  = nBMPPitch * nRoomH_px;
+		const size_t nBMPOffset = get_bitmap_offset( nBitmapBits );
+		bool         bWroteData = true;
+		bool         bWroteBMP  = true;
+
+		if (pBitmap)
+		{
+			uint8_t aHeader[ BMP_HEADER_SIZE + 4*BMP_PALETTE_SIZE ];
+			make_bitmap_header( aHeader, nWidth, nHeight, nBitmapBits );
+			bWroteBMP = (fwrite( aHeader, 1, nBMPOffset, pBitmap ) == nBMPOffset);
+		}
+
+		Surface8_t aRing[ STREAM_RING ];
+		for (int iSlot = 0; iSlot < STREAM_RING; ++iSlot)
+			alloc_surface( &aRing[ iSlot ], nRoomsW, 1, nRoomW_px, nRoomH_px, INDEX_TRANSPARENT );
+		uint32_t *pOutput = new uint32_t[ nBandBytes / 4 ](); // () = zero the .BMP row padding
+
+		std::mutex              lock;
+		std::condition_variable signal;
+		int                     nDrawn   = 0;
+		int                     nWritten = 0;
+
+		std::thread writer( [&]()
+		{
+			for (int iBand = 0; iBand < nBands; ++iBand)
+			{
+				{
+					std::unique_lock<std::mutex> guard( lock );
+					signal.wait( guard, [&]{ return nDrawn > iBand; } );
+				}
+
+				const Surface8_t &band = aRing[ iBand % STREAM_RING ];
+
+				if (pData)
+				{
+					for (int y = 0; y < nRoomH_px; ++y)
+						expand_row<RGBA_t>( pOutput + y*nWidth, band.pPixels + y*band.nPitch, nWidth );
+					bWroteData &= (fwrite( pOutput, 1, nBandBytes, pData ) == nBandBytes);
+				}
+
+				if (pBitmap)
+				{
+					// Stupid Windows .BMP are upside down: reverse the band's scanlines and place it from the end
+					uint8_t *pRow = (uint8_t*) pOutput;
+					for (int y = 0; y < nRoomH_px; ++y, pRow += nBMPPitch)
+					{
+						const uint8_t *pSrc = band.pPixels + (nRoomH_px - 1 - y)*band.nPitch;
+						if (nBitmapBits <= 8)
+							pack_bitmap_row( pRow, pSrc, nWidth, nBitmapBits );
+						else
+							expand_row<BGRA_t>( (uint32_t*) pRow, pSrc, nWidth );
+					}
+
+					uint64_t nOffset = nBMPOffset + (uint64_t)(nHeight - (iBand + 1)*nRoomH_px) * nBMPPitch;
+					bWroteBMP &= seek_file( pBitmap, nOffset );
+					bWroteBMP &= (fwrite( pOutput, 1, nBMPBytes, pBitmap ) == nBMPBytes);
+				}
+
+				{
+					std::lock_guard<std::mutex> guard( lock );
+					nWritten++;
+				}
+				signal.notify_all();
+			}
+		});
+
+		for (int iBand = 0; iBand < nBands; ++iBand)
+		{
+			{
+				std::unique_lock<std::mutex> guard( lock );
+				signal.wait( guard, [&]{ return iBand - nWritten < STREAM_RING; } ); // slot is free
+			}
+
+			pDrawBand( pDecoder, &aRing[ iBand % STREAM_RING ], iBand, pHistogram );
+
+			{
+				std::lock_guard<std::mutex> guard( lock );
+				nDrawn++;
+			}
+			signal.notify_all();
+		}
+
+		writer.join();
+
+		delete [] pOutput;
+		for (int iSlot = 0; iSlot < STREAM_RING; ++iSlot)
+			free_surface( &aRing[ iSlot ] );
+
+		if (pData)
+		{
+			fclose( pData );
+			pDecoder->metrics.nBytesWritten += (uint64_t) nBands * nBandBytes;
+			if (!bWroteData)
+				printf( "ERROR: Couldn't write all of: '%s'\n", pDataName );
+			else
+			if (!pDecoder->options.bQuiet)
+				printf( "Saved: %s\n", pDataName );
+		}
+
+		if (pBitmap)
+		{
+			fclose( pBitmap );
+			pDecoder->metrics.nBytesWritten += nBMPOffset + (uint64_t) nBands * nBMPBytes;
+			if (!bWroteBMP)
+				printf( "ERROR: Couldn't write all of: '%s'\n", pBitmapName );
+			else
+			if (!pDecoder->options.bQuiet)
+				printf( "Saved: %s\n", pBitmapName );
+		}
+	}
+
+	// Streaming equivalent of draw_rooms() + write_files()
+	// ========================================
+	void stream_files (Decoder_t *pDecoder, const int nRooms)
 	{
-		for (int y = 0; y < ROOM1C_H; y++)
+		memset(pDecoder->aHistogram , 0, sizeof(pDecoder->aHistogram) );
+
+		write_tiles32bpp( pDecoder );
+
+		const int nMapW = pDecoder->world.nMapWidth;
+		const int nMapH = pDecoder->world.nMapHeight;
+
+		char sDataName  [ MAX_FILE_NAME ];
+		char sBitmapName[ MAX_FILE_NAME ];
+		sprintf( sDataName  , "%sWorldMap2D_%dx%d_rooms_rgba32_%dx%d.data", pDecoder->sOutputDir, nMapW, nMapH, nMapW*ROOM2D_W_PX, nMapH*ROOM2D_H_PX );
+		sprintf( sBitmapName, "%sWorldMap2D_%dx%d_rooms.bmp", pDecoder->sOutputDir, nMapW, nMapH );
+
+		if (!pDecoder->options.bQuiet)
+			printf( "Streaming World Map 2D: %d x %d rooms, %d bands\n", nMapW, nMapH, nMapH );
+		stream_map( pDecoder, pDecoder->options.bRawData ? sDataName : NULL, sBitmapName, pDecoder->options.nBitmapBits, nMapW, nMapH, ROOM2D_W_PX, ROOM2D_H_PX, draw_band_2D, pDecoder->aHistogram );
+
+		if (pDecoder->options.bRender1D && pDecoder->options.bRawData)
 		{
-#endif
-			// Map contains Tiles that are in Little Endian format: xx yy
-			iTile = *pSrc++;
-			gHistogram[iTile]++;
-			draw_tile(iTile, x, y + nNextRoomY/TILE_H); // Draws room to 1D WorldMap
+			sprintf( sDataName, "%sWorldMap1D_%dx%d_rooms_rgba32_%dx%d.data", pDecoder->sOutputDir, 1, nRooms, ROOM1C_W_PX, nRooms*ROOM1C_H_PX );
+
+			if (!pDecoder->options.bQuiet)
+				printf( "Streaming World Map 1D: %d x %d rooms, %d bands\n", 1, nRooms, nRooms );
+			stream_map( pDecoder, sDataName, NULL, 32, 1, nRooms, ROOM1C_W_PX, ROOM1C_H_PX, draw_band_1D, NULL );
 		}
+
+		dump_histogram( pDecoder );
 	}
-}
 
 // ========================================
-void draw_2d_glyph (uint8_t c, const int iTextX, const int iTextY)
+void write_files (Decoder_t *pDecoder)
 {
-	uint32_t *pSrc = gUnpackedFont8x8RGBA + c*CGA_TILE_Z;
-	uint32_t *pDst = gWorldMap2D          + iTextY*MAP2D_IMAGE_W + iTextX;
-
-	for (int y = 0; y < CGA_TILE_H; ++y)
+	write_tiles32bpp( pDecoder );
+	if (pDecoder->options.bPNG)
+		write_maps_png( pDecoder ); // before -mmap unmaps the World Maps
+	if (pDecoder->options.bDeepZoom)
+		write_map2D_pyramid( pDecoder );
+	if (pDecoder->options.bMapOutput)
+		unmap_outputs( pDecoder ); // already rendered into the files
+	else
 	{
-		for (int x = 0; x < CGA_TILE_W; ++x)
+		if (pDecoder->options.bRawData)
 		{
-			*pDst++ = *pSrc++;
+			if (pDecoder->options.bRender1D)
+				write_map1C_rgba32( pDecoder );
+			write_map2D_rgba32( pDecoder );
 		}
-		pDst -= CGA_TILE_W;
-		pDst += MAP2D_IMAGE_W;
+
+		write_map2D_bitmap( pDecoder );
 	}
+	dump_histogram( pDecoder );
 }
 
+// Micro-benchmark: blit atlas tiles into a room sized scratch surface with each blitter
 // ========================================
-void draw_rooms (int nRooms)
+void bench_blit (Decoder_t *pDecoder)
 {
-	memset(gWorldMap1D, 0, sizeof(gWorldMap1D));
-	memset(gWorldMap2D, 0, sizeof(gWorldMap2D));
-	memset(gHistogram , 0, sizeof(gHistogram) );
+	const int BENCH_TILES = 1 << 22;
+
+	// 8x8 tile blit into one room sized surface
+	struct Blit_t
+	{
+		const char *pName;
+		Blit8x8_t   pBlit8x8;
+	};
 
-	gWorldMeta.nMapWidth  = (gWorldMeta.nMaxRoomX -gWorldMeta.nMinRoomX) + 1;
-	gWorldMeta.nMapHeight = (gWorldMeta.nMaxRoomY -gWorldMeta.nMinRoomY) + 1;
+	Blit_t aBlitter[3] = { { "scalar", blit_8x8_scalar } };
+	int    nBlitter    = 1;
+#if SIMD_X86
+	aBlitter[ nBlitter++ ] = { "sse2", blit_8x8_sse2 };
+	if (cpu_has_avx2())
+		aBlitter[ nBlitter++ ] = { "avx2", blit_8x8_avx2 };
+#endif
 
-	printf( "World size: %d x %d rooms\n", gWorldMeta.nMapWidth, gWorldMeta.nMapHeight );
-	printf( "   Left : %+3d, Top: %+3d\n", gWorldMeta.nMinRoomX, gWorldMeta.nMinRoomY );
-	printf( "   Right: %+3d, Bot: %+3d\n", gWorldMeta.nMaxRoomX, gWorldMeta.nMaxRoomY );
+	Surface32_t reference, scratch;
+	alloc_surface( &reference, 1, 1, ROOM1C_W_PX, ROOM1C_H_PX );
+	alloc_surface( &scratch  , 1, 1, ROOM1C_W_PX, ROOM1C_H_PX );
 
-	int nNextRoomStartY = 0;
-	for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+	printf( "Tile blit benchmark: %d tiles\n", BENCH_TILES );
+
+	for (int iBlitter = 0; iBlitter < nBlitter; ++iBlitter)
 	{
-		printf( "Drawing room #%d\n", iRoom );
-		draw_1D_room( iRoom, nNextRoomStartY );
-		nNextRoomStartY += ROOM1C_H_PX;
+		Blit8x8_t pBlit    = aBlitter[ iBlitter ].pBlit8x8;
+		Surface32_t *pTarget = (iBlitter == 0) ? &reference : &scratch;
+
+		auto tStart = std::chrono::steady_clock::now();
+		for (int iTile = 0; iTile < BENCH_TILES; ++iTile)
+		{
+			int iSrcTile = iTile % NUM_TILE;
+			int iDstTile = iTile % ROOM1C_Z;
+			const uint32_t *pSrc = pDecoder->assets.pTilesRGBA + (iSrcTile / ATLAS_W ) * TILE_H * ATLAS_IMAGE_W    + (iSrcTile % ATLAS_W ) * TILE_W;
+			uint32_t *pDst = pTarget->pPixels + (iDstTile / ROOM1C_W) * TILE_H * pTarget->nPitch + (iDstTile % ROOM1C_W) * TILE_W;
+			pBlit( pDst, pTarget->nPitch, pSrc, ATLAS_IMAGE_W );
+		}
+		auto   tEnd  = std::chrono::steady_clock::now();
+		double nSecs = std::chrono::duration<double>( tEnd - tStart ).count();
+
+		bool bSame = (iBlitter == 0) || (memcmp( reference.pPixels, scratch.pPixels, reference.nSize ) == 0);
+		printf( "  %-6s: %8.2f M tiles/s, %8.2f MPix/s%s\n",
+			aBlitter[ iBlitter ].pName,
+			BENCH_TILES / nSecs / 1e6,
+			BENCH_TILES * (double)TILE_Z / nSecs / 1e6,
+			bSame ? "" : "  ERROR: output differs from scalar!" );
+	}
+
+	// Palette expansion of one room sized indexed image
+	struct Expander_t
+	{
+		const char     *pName;
+		ExpandIndexed_t pExpand;
+	};
+
+	Expander_t aExpander[3] = { { "scalar", expand_indexed_scalar } };
+	int        nExpander    = 1;
+#if SIMD_X86
+	if (cpu_has_ssse3())
+		aExpander[ nExpander++ ] = { "ssse3", expand_indexed_ssse3 };
+	if (cpu_has_avx2())
+		aExpander[ nExpander++ ] = { "avx2" , expand_indexed_avx2  };
+#endif
+
+	const int BENCH_ROOMS = 1 << 11;
+	const int nPixels     = ROOM1C_W_PX * ROOM1C_H_PX;
+	uint8_t  *pIndices    = new uint8_t[ nPixels ];
+	for (int i = 0; i < nPixels; ++i)
+		pIndices[ i ] = pDecoder->assets.pTilesIndexed[ i % (ATLAS_IMAGE_W * ATLAS_IMAGE_H) ];
 
-		RoomDesc_t *pDesc  = gRooms[ iRoom ].pRoomDesc;
-		int         nRoomX = pDesc->nRoomX - gWorldMeta.nMinRoomX; // remap [-10,-5] -> [0,0]
-		int         nRoomY = pDesc->nRoomY - gWorldMeta.nMinRoomY;
+	printf( "Palette expand benchmark: %d rooms\n", BENCH_ROOMS );
 
-		copy_room( iRoom, nRoomX, nRoomY );                 // Copies room from 1D WorldMap to 2D WorldMap
-		draw_text_centered( pDesc->pDesc, nRoomX, nRoomY ); // Draw Text on 2D World Map
+	for (int iExpander = 0; iExpander < nExpander; ++iExpander)
+	{
+		ExpandIndexed_t pExpand = aExpander[ iExpander ].pExpand;
+		Surface32_t    *pTarget = (iExpander == 0) ? &reference : &scratch;
+
+		auto tStart = std::chrono::steady_clock::now();
+		for (int iRoom = 0; iRoom < BENCH_ROOMS; ++iRoom)
+			pExpand( pTarget->pPixels, pIndices, nPixels, gPalette );
+		auto   tEnd  = std::chrono::steady_clock::now();
+		double nSecs = std::chrono::duration<double>( tEnd - tStart ).count();
+
+		bool bSame = (iExpander == 0) || (memcmp( reference.pPixels, scratch.pPixels, reference.nSize ) == 0);
+		printf( "  %-6s: %8.2f MPix/s%s\n",
+			aExpander[ iExpander ].pName,
+			(double)BENCH_ROOMS * nPixels / nSecs / 1e6,
+			bSame ? "" : "  ERROR: output differs from scalar!" );
 	}
+
+	delete [] pIndices;
+	free_surface( &scratch   );
+	free_surface( &reference );
 }
 
-// Copy from 1D 1x8 @ 32bpp to World Map 2D 6080x2600
+// Stage benchmark: timing of one stage over nSamples runs
+struct BenchStats_t
+{
+	double nMean;   // seconds per run
+	double nStdDev;
+	double nMin;
+	PerfCounters_t perf; // -perf: per run
+};
+
 // ========================================
-void draw_text_centered (const char *pText, const int iRoomX, const int iRoomY)
+template<typename Stage>
+BenchStats_t bench_stage (const Decoder_t *pDecoder, const int nSamples, Stage stage)
 {
-	int nLen   = (int) strlen( pText );
-	int iLeftX = (ROOM1C_W - nLen)/2;
+	double *aSecs = new double[ nSamples ];
+
+	stage(); // warm up caches and page in buffers
 
-	int iCol   = 0;
-	int iTextX =  (iRoomX    * ROOM1C_W_PX)             ; // NOTE: Intentional inconsistency
-	int iTextY = ((iRoomY+1) * ROOM2D_H_PX) - CGA_TILE_H; // with Room1C_W and Room2D_H
+	PerfCounters_t perfStart, perfEnd;
+	if (pDecoder->options.bPerf)
+		read_perf( &pDecoder->metrics, &perfStart );
 
-	// blanks on left
-	for (iCol = 0; iCol < iLeftX; ++iCol)
+	for (int iSample = 0; iSample < nSamples; ++iSample)
 	{
-		draw_2d_glyph( ' ', iTextX, iTextY );
-		iTextX += CGA_TILE_W;
+		auto tStart = std::chrono::steady_clock::now();
+		stage();
+		auto tEnd   = std::chrono::steady_clock::now();
+		aSecs[ iSample ] = std::chrono::duration<double>( tEnd - tStart ).count();
 	}
 
-	for (int iGlyph = 0; iGlyph < nLen; ++iGlyph)
+	BenchStats_t stats = {};
+	stats.nMin = aSecs[0];
+	if (pDecoder->options.bPerf)
 	{
-		uint8_t c = pText[iGlyph];
-		draw_2d_glyph( c, iTextX, iTextY );
-		iTextX += CGA_TILE_W;
-		iCol++;
+		read_perf( &pDecoder->metrics, &perfEnd ); // also counts the timing loop itself, a few instructions per sample
+		diff_perf( &stats.perf, perfStart, perfEnd );
+		for (int iCounter = 0; iCounter < NUM_PERF; ++iCounter)
+			if (stats.perf.aCount[ iCounter ] != PERF_NONE)
+				stats.perf.aCount[ iCounter ] /= nSamples;
 	}
-
-	// blanks on right
-	for ( ; iCol < ROOM1C_W; ++iCol)
+	for (int iSample = 0; iSample < nSamples; ++iSample)
 	{
-		draw_2d_glyph( ' ', iTextX, iTextY );
-		iTextX += CGA_TILE_W;
+		stats.nMean += aSecs[ iSample ] / nSamples;
+		if (aSecs[ iSample ] < stats.nMin)
+			stats.nMin = aSecs[ iSample ];
 	}
-}
+	for (int iSample = 0; iSample < nSamples; ++iSample)
+		stats.nStdDev += (aSecs[ iSample ] - stats.nMean) * (aSecs[ iSample ] - stats.nMean) / nSamples;
+	stats.nStdDev = sqrt( stats.nStdDev );
 
+	delete [] aSecs;
+	return stats;
+}
 
-// Copy from 2D 8x8 @ 32bbp gTilesRGBA[] to World Map 1D 320x9999 @ 32bppp gWorldMap1D
+// One line per stage: time per op (+/- std dev), and pixel / byte throughput of a mean run
 // ========================================
-void draw_tile (const int16_t iTile, const int iDstTileX, const int iDstTileY)
+void print_bench (const Decoder_t *pDecoder, const char *pStage, const char *pOp, const BenchStats_t &stats, const double nOps, const double nPixels, const double nBytes)
 {
-	int iSrcTileX = (iTile >> 0) & 0xFF;
-	int iSrcTileY = (iTile >> 8) & 0xFF;
+	printf( "  %-28s %12.1f ns/%-6s +/- %5.1f%%", pStage, stats.nMean / nOps * 1e9, pOp, 100.0 * stats.nStdDev / stats.nMean );
+	if (nPixels > 0) printf( "  %10.1f MPix/s", nPixels / stats.nMean / 1e6 );
+	if (nBytes  > 0) printf( "  %10.1f MB/s"  , nBytes  / stats.nMean / (1024.0 * 1024.0) );
+	printf( "\n" );
 
-#ifndef TUTORIAL
-	// Never should have an invalid atlas tile
-	if ((iSrcTileX >= ATLAS_W) || (iSrcTileY >= ATLAS_H))
+	if (pDecoder->options.bPerf)
 	{
-		printf( "ERROR: Invalid map tile! 0x%04X, DstTileX: %d, DstTileY: %d\n", iTile, iDstTileX, iDstTileY );
-		return;
+		const uint64_t *aCount = stats.perf.aCount;
+		printf( "  %-28s", "" );
+		for (int iCounter = 0; iCounter < NUM_PERF; ++iCounter)
+		{
+			if (aCount[ iCounter ] == PERF_NONE)
+				printf( "  %s: n/a", gaPerfName[ iCounter ] );
+			else
+				printf( "  %s/%s: %.2f", gaPerfName[ iCounter ], pOp, aCount[ iCounter ] / nOps );
+		}
+		if ((aCount[ PERF_CYCLES ] != PERF_NONE) && (aCount[ PERF_INSTRUCTIONS ] != PERF_NONE) && aCount[ PERF_CYCLES ])
+			printf( "  IPC: %.2f", (double) aCount[ PERF_INSTRUCTIONS ] / (double) aCount[ PERF_CYCLES ] );
+		printf( "\n" );
 	}
-#endif
+}
 
-	iSrcTileX &= (ATLAS_W - 1);
-	iSrcTileY &= (ATLAS_H - 1);
+// Render the decoder's world, then time write_map2D_bitmap() on it
+// ========================================
+void bench_bitmap (Decoder_t *pDecoder, const int nSamples, const char *pStage)
+{
+	draw_rooms( pDecoder, pDecoder->world.nRooms );
 
-	uint32_t *src = gTilesRGBA  + (iSrcTileY * TILE_H * ATLAS_IMAGE_W) + (iSrcTileX * TILE_W);
-	uint32_t *dst = gWorldMap1D + (iDstTileY * TILE_H * MAP1C_IMAGE_W) + (iDstTileX * TILE_W);
+	const double nPixels = (double) pDecoder->world.nMapWidth * ROOM2D_W_PX * pDecoder->world.nMapHeight * ROOM2D_H_PX;
+	BenchStats_t stats   = bench_stage( pDecoder, nSamples, [pDecoder]{ write_map2D_bitmap( pDecoder ); } );
+	print_bench( pDecoder, pStage, "file", stats, 1, nPixels, BMP_HEADER_SIZE + 4*nPixels );
 
-	for( int y = 0; y < TILE_H; y++ )
+	free_surface( &pDecoder->worldMap1D );
+	free_surface( &pDecoder->worldMap2D );
+	free_surface( &pDecoder->indexMap1D );
+	free_surface( &pDecoder->indexMap2D );
+	free_surface( &pDecoder->bitmap2D   );
+}
+
+// A synthetic .map: nScale copies of the loaded world tiled side by side on the World Map.
+// Copies outside the shipped world have no room description and are labelled as undocumented rooms.
+// ========================================
+uint8_t* make_synthetic_map (const Decoder_t *pDecoder, const int nScale, size_t *pSize)
+{
+	const int nRooms   = pDecoder->world.nRooms;
+	const int nTotal   = nRooms * nScale;
+	const int nCopiesW = (int) ceil( sqrt( (double) nScale ) );
+	const int nRoomRec = 2*(4 + ROOM1C_Z); // x, y int32 + tiles
+
+	*pSize = sizeof(MapHeader_t) + (size_t) nTotal * nRoomRec;
+	uint8_t *pMap = new uint8_t[ *pSize ];
+
+	MapHeader_t header = pDecoder->mapHeader;
+	header.nVersion = META_version;
+	header.nRooms   = nTotal;
+	memcpy( pMap, &header, sizeof(header) );
+
+	uint8_t *pDst = pMap + sizeof(MapHeader_t);
+	for (int iCopy = 0; iCopy < nScale; ++iCopy)
 	{
-		for (int x = 0; x < TILE_W; x++)
+		for (int iRoom = 0; iRoom < nRooms; ++iRoom, pDst += nRoomRec)
 		{
-			*dst++ = *src++;
+			int32_t aPos[2] =
+			{
+				pDecoder->aRooms[ iRoom ].nRoomX + (iCopy % nCopiesW) * pDecoder->world.nMapWidth,
+				pDecoder->aRooms[ iRoom ].nRoomY + (iCopy / nCopiesW) * pDecoder->world.nMapHeight
+			};
+			memcpy( pDst    , aPos, sizeof(aPos) );
+			memcpy( pDst + 8, pDecoder->aRooms[ iRoom ].pRoomData, 2*ROOM1C_Z );
 		}
-		src -= TILE_W; src += ATLAS_IMAGE_W;
-		dst -= TILE_W; dst += MAP1C_IMAGE_W;
 	}
+
+	return pMap;
 }
 
+// -bench #: time each stage on its own over a synthetic map # times the shipped world, then exit
 // ========================================
-void dump_histogram ()
+void bench_stages (Decoder_t *pDecoder, const int nScale)
 {
-	printf( "Histogram Map Tiles (Tile = 0xYYXX)\n" );
+	const int BENCH_SAMPLES = 10;
+	const int BENCH_REPEAT  = 64; // runs per sample of the stages that only take a few us
+	const int BENCH_MAX_BMP = 1024; // MB, larger synthetic 2D World Maps time the .BMP writer on the shipped world
+
+	if (!pDecoder->world.nRooms)
+	{
+		printf( "ERROR: No rooms to benchmark!\n" );
+		return;
+	}
 
-	int used_tiles = 0; // yyxx
-	for (int i = 0; i < 0x2000; ++i)
+	printf( "Stage benchmark: %d samples per stage\n", BENCH_SAMPLES );
+	const bool bQuiet = pDecoder->options.bQuiet;
+	pDecoder->options.bQuiet = true;
+
+	size_t      nMapSize   = 0;
+	uint8_t    *pMap       = make_synthetic_map( pDecoder, nScale, &nMapSize );
+	MapView_t   realMap    = pDecoder->map;
+	MapHeader_t realHeader = pDecoder->mapHeader;
+	WorldMeta_t realWorld  = pDecoder->world;
+	Room_t     *aRealRooms = pDecoder->aRooms;
+	Labels_t    realLabels = pDecoder->labels;
+	int        *aRealDedup = pDecoder->aRoomDedup;
+	int        *aRealIndex = pDecoder->aRoomIndex;
+
+	pDecoder->map.pData = pMap;
+	pDecoder->map.nSize = nMapSize;
+	pDecoder->aRooms    = NULL; // count_rooms() frees the previous rooms
+	memset( &pDecoder->labels, 0, sizeof(pDecoder->labels) ); // make_labels() frees the previous labels
+	pDecoder->aRoomDedup = NULL;                               // dedup_rooms() too
+	pDecoder->aRoomIndex = NULL;                               // and index_rooms()
+
+	const int nRooms = count_rooms( pDecoder );
+	const int nTiles = nRooms * ROOM1C_Z;
+	printf( "Synthetic map: %dx = %d rooms, %d x %d World Map, %d KB\n", nScale, nRooms, pDecoder->world.nMapWidth, pDecoder->world.nMapHeight, (int)(nMapSize / K) );
+
+	BenchStats_t stats;
+
+	stats = bench_stage( pDecoder, BENCH_SAMPLES, [pDecoder]{ count_rooms( pDecoder ); } );
+	print_bench( pDecoder, "count_rooms", "room", stats, nRooms, 0, (double) nMapSize );
+
+	// Into scratch atlases: the shared one may be in use by other decoders
+	uint32_t *pAtlasRGBA = new uint32_t[ TILE_Z * NUM_TILE ];
+	uint32_t *pAtlasBGRA = new uint32_t[ TILE_Z * NUM_TILE ];
+	stats = bench_stage( pDecoder, BENCH_SAMPLES, [pAtlasRGBA, pAtlasBGRA]{ for (int i = 0; i < BENCH_REPEAT; ++i) convert_tiles_8bpp_32rgba( pAtlasRGBA, pAtlasBGRA ); } );
+	print_bench( pDecoder, "convert_tiles_8bpp_32rgba", "atlas", stats, BENCH_REPEAT, 2.0 * BENCH_REPEAT * ATLAS_IMAGE_W * ATLAS_IMAGE_H, 0 ); // RGBA + BGRA
+	delete [] pAtlasBGRA;
+	delete [] pAtlasRGBA;
+
+	stats = bench_stage( pDecoder, BENCH_SAMPLES, [pDecoder, nRooms]
 	{
-		if (((i >> 8) & 0xFF) >= ATLAS_H) continue;
-		if (((i >> 0) & 0xFF) >= ATLAS_W) continue;
+		RoomTiles_t tiles;
+		for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+			prepare_room( pDecoder, &tiles, iRoom, pDecoder->aHistogram );
+	});
+	print_bench( pDecoder, "prepare_room (copy_room)", "room", stats, nRooms, 0, 2.0 * nTiles );
 
-		printf( "%04X: %6d  ", i, gHistogram[i] );
+	stats = bench_stage( pDecoder, BENCH_SAMPLES, [pDecoder]
+	{
+		TileStats_t tileStats;
+		analyze_tiles( pDecoder, &tileStats );
+		free_tile_stats( &tileStats );
+	});
+	print_bench( pDecoder, "analyze_tiles", "room", stats, nRooms, 0, 2.0 * nTiles );
 
-		if ((i & 0xF) == 0xF)
-			printf( "\n" );
+	stats = bench_stage( pDecoder, BENCH_SAMPLES, [pDecoder]{ dedup_rooms( pDecoder ); } );
+	print_bench( pDecoder, "dedup_rooms (roll_hash)", "room", stats, nRooms, 0, 2.0 * nTiles );
 
-		if( gHistogram[i])
-			used_tiles++;
+	stats = bench_stage( pDecoder, BENCH_SAMPLES, [pDecoder]
+	{
+		SimilarRooms_t *aSimilar = NULL;
+		find_similar_rooms( pDecoder, &aSimilar );
+		delete [] aSimilar;
+	});
+	print_bench( pDecoder, "find_similar_rooms", "room", stats, nRooms, 0, 2.0 * nTiles );
+
+	Surface32_t room;
+	alloc_surface( &room, 1, 1, ROOM2D_W_PX, ROOM2D_H_PX );
+
+	stats = bench_stage( pDecoder, BENCH_SAMPLES, [pDecoder, nRooms, &room]
+	{
+		for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+			draw_room( pDecoder, &room, iRoom, 0, 0, NULL );
+	});
+	print_bench( pDecoder, "draw_room (draw_1D_room)", "room", stats, nRooms, (double) nRooms * ROOM1C_W_PX * ROOM1C_H_PX, 0 );
+
+	stats = bench_stage( pDecoder, BENCH_SAMPLES, [pDecoder, nRooms, &room]
+	{
+		for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+		{
+			const int16_t *pSrc = pDecoder->aRooms[ iRoom ].pRoomData;
+			for (int x = 0; x < ROOM1C_W; ++x)
+				for (int y = 0; y < ROOM1C_H; ++y)
+					draw_tile( pDecoder, &room, *pSrc++, x*TILE_W, y*TILE_H );
+		}
+	});
+	print_bench( pDecoder, "draw_tile", "tile", stats, nTiles, (double) nTiles * TILE_Z, 0 );
+
+	stats = bench_stage( pDecoder, BENCH_SAMPLES, [pDecoder]{ make_labels( pDecoder ); } );
+	print_bench( pDecoder, "make_labels (rasterize_label)", "label", stats, pDecoder->labels.nLabels, 2.0 * pDecoder->labels.nLabels * CGA_LABEL_Z, 0 ); // RGBA + indexed
+
+	stats = bench_stage( pDecoder, BENCH_SAMPLES, [pDecoder, nRooms, &room]
+	{
+		for (int iRoom = 0; iRoom < nRooms; ++iRoom)
+			draw_label( pDecoder, &room, iRoom, 0, 0 );
+	});
+	print_bench( pDecoder, "draw_label", "label", stats, nRooms, (double) nRooms * CGA_LABEL_Z, 0 );
+
+	free_surface( &room );
+
+	// .BMP writer on the synthetic world, rendered with the labels and dedup map of the stages above.
+	// Its 2D World Map is 4 bytes per pixel, so a large -bench # falls back to the shipped world.
+	const int nMapMB = (int)((double) pDecoder->world.nMapWidth * ROOM2D_W_PX * pDecoder->world.nMapHeight * ROOM2D_H_PX * 4 / (K*K));
+	if (nMapMB <= BENCH_MAX_BMP)
+	{
+		index_rooms( pDecoder );
+		bench_bitmap( pDecoder, BENCH_SAMPLES, "write_map2D_bitmap" );
 	}
 
-	printf( "Used   tiles: %d\n", used_tiles );
-	printf( "Unused tiles: %d\n", NUM_TILE - used_tiles );
-	printf( "Total  tiles: %d\n", NUM_TILE );
-	printf( "Efficiency: %5.2f%%\n", 100.0 * (double)used_tiles / (double)NUM_TILE );
+	delete [] pDecoder->aRooms;
+	delete [] pDecoder->aRoomDedup;
+	delete [] pDecoder->aRoomIndex;
+	free_labels( &pDecoder->labels );
+	pDecoder->aRooms     = aRealRooms;
+	pDecoder->aRoomDedup = aRealDedup;
+	pDecoder->aRoomIndex = aRealIndex;
+	pDecoder->labels     = realLabels;
+	pDecoder->world      = realWorld;
+	pDecoder->mapHeader  = realHeader;
+	pDecoder->map        = realMap;
+	delete [] pMap;
+
+	if (nMapMB > BENCH_MAX_BMP)
+	{
+		printf( "  NOTE: synthetic 2D World Map is %d MB > %d MB, write_map2D_bitmap is timed on the shipped world\n", nMapMB, BENCH_MAX_BMP );
+		bench_bitmap( pDecoder, BENCH_SAMPLES, "write_map2D_bitmap (shipped)" );
+	}
+	pDecoder->options.bQuiet = bQuiet;
 }
 
-// ========================================
-void read_files ()
-{
-	read_map();
-	read_tiles8bpp();
-}
+// Decoder ____________________________________________________________
 
-// Read the raw binary map
+// Blitter and PNG tables: the same for every decoder, set up by the first one
 // ========================================
-void read_map ()
+void init_shared ()
 {
-	gSize = read_file( "yhtwtg.map", gRawMap, sizeof( gRawMap ) );
-}
+	static std::once_flag once;
+	std::call_once( once, []
+	{
+		init_blitter();
+		printf( "Blitter: %s\n", gBlitter.pName );
 
-// Read texture atlas
-// ========================================
-void read_tiles8bpp ()
-{
-	// Note: Source file is `tiles.bmp` but we read a raw image exported with GIMP so we don't need .BMP reading code
-	nTilesRawIndex = read_file( "tiles_raw_indexed.data", gTilesRawIndex, 192*K );
+		make_png_tables();
+	});
 }
 
-// Writes the one column Map to a raw 1:1 image file
+// Texture atlas shared by every decoder that doesn't map a baked world: read and converted once.
+// The font and palettes are compile time tables.
 // ========================================
-void write_map1C_rgba32 ()
+void load_assets (Decoder_t *pDecoder)
 {
-	printf( "Native 1:1 World Map 1D (raw 32-bit RGBA)\n" );
-	printf( "  Image Dimensions: %d x %d px\n", MAP1C_IMAGE_W, MAP1C_IMAGE_H );
-	printf( "  Rooms: %d x %d\n", MAP1C_ROOM_W, MAP1C_ROOM_H );
-	printf( "\n" );
-
-	char sFileName[256];
-	sprintf( sFileName, "WorldMap1D_%dx%d_rooms_rgba32_%dx%d.data", MAP1C_ROOM_W, MAP1C_ROOM_H, MAP1C_IMAGE_W, MAP1C_IMAGE_H );
-	write_file( sFileName, gWorldMap1D, MAP1C_SIZE );
+	static std::once_flag once;
+	std::call_once( once, [pDecoder]
+	{
+		//pack_CGA_font();
+#ifdef SAVE_CGA_FONT
+		save_CGA_font();
+#endif
+		read_tiles8bpp( pDecoder );
+		convert_tiles_8bpp_32rgba( gTilesRGBA, gTilesBGRA );
+		convert_tiles_8bpp_indexed( gTilesIndexed );
+	});
 }
 
 // ========================================
-void write_map2D_rgba32 ()
+void validate_options (DecodeOptions_t *pOptions)
 {
-	printf( "Native 1:1 World Map 2D (raw 32-bit RGBA)\n" );
-	printf( "  Image Dimensions: %d x %d px\n", MAP2D_IMAGE_W, MAP2D_IMAGE_H );
-	printf( "  Rooms: %d x %d\n", MAP2D_ROOW_W, MAP2D_ROOM_H );
-	printf( "\n" );
-
-	char sFileName[256];
-	sprintf( sFileName, "WorldMap2D_%dx%d_rooms_rgba32_%dx%d.data", MAP2D_ROOW_W, MAP2D_ROOM_H, MAP2D_IMAGE_W, MAP2D_IMAGE_H );
-	write_file( sFileName, gWorldMap2D, MAP2D_SIZE );
-}
+	if ((pOptions->nBitmapBits != 4) && (pOptions->nBitmapBits != 8) && (pOptions->nBitmapBits != 32))
+	{
+		printf( "WARNING: -bmp %d not supported, using 32-bpp\n", pOptions->nBitmapBits );
+		pOptions->nBitmapBits = 32;
+	}
 
-void write_map2D_bitmap ()
-{
-	const int BMP_HEADER_SIZE = 54;
+	if (pOptions->nBitmapBits <= 8)
+		pOptions->bIndexed = true; // indexed .BMP is written straight from the palette indices
 
-	uint32_t aHeader[13]; // Windows .BMP header, "BM" + 13*int32 = 54 bytes
-	int      nPlanes   = 1;
-	int      nBitcount = 32 << 16; // nBitCount and nPlanes are 16-bit in the header but we pack them together
+	if (pOptions->bMapOutput && (pOptions->bIndexed || pOptions->bStream))
+	{
+		printf( "WARNING: -mmap renders 32-bpp directly into the files, ignored with -indexed or -stream\n" );
+		pOptions->bMapOutput = false;
+	}
 
-	// Header: Note that the "BM" identifier in bytes 0 and 1 is NOT included in this header but IS written to the file
-	aHeader[ 0] = BMP_HEADER_SIZE + MAP2D_SIZE; // bfSize (total file size)
-	aHeader[ 1] = 0;                            // bfReserved1 bfReserved2
-	aHeader[ 2] = BMP_HEADER_SIZE;              // bfOffbits
-	aHeader[ 3] = 40;                           // biSize BITMAPHEADER
-	aHeader[ 4] = MAP2D_IMAGE_W;                // biWidth
-	aHeader[ 5] = MAP2D_IMAGE_H;                // biHeight
-	aHeader[ 6] = nBitcount | nPlanes;          // biPlanes, biBitcount
-	aHeader[ 7] = 0;                            // biCompression
-	aHeader[ 8] = MAP2D_SIZE;                   // biSizeImage
-	aHeader[ 9] = 0;                            // biXPelsPerMeter
-	aHeader[10] = 0;                            // biYPelsPerMeter
-	aHeader[11] = 0;                            // biClrUsed
-	aHeader[12] = 0;                            // biClrImportant
+	if (pOptions->bIncremental && (pOptions->bStream || pOptions->bPNG || pOptions->bDeepZoom))
+	{
+		printf( "WARNING: -incremental only patches the .data and .bmp, ignored with -stream, -png or -dzi\n" );
+		pOptions->bIncremental = false;
+	}
 
-	uint32_t nFileSize = BMP_HEADER_SIZE + MAP2D_SIZE;
-	uint8_t *pBuffer   = new uint8_t [ nFileSize ];
+	if ((pOptions->bPNG || pOptions->bDeepZoom) && pOptions->bStream)
+	{
+		printf( "WARNING: -png and -dzi need the full World Maps, ignored with -stream\n" );
+		pOptions->bPNG      = false;
+		pOptions->bDeepZoom = false;
+	}
 
-	pBuffer[0] = 'B';
-	pBuffer[1] = 'M';
-	memcpy( pBuffer+2, &aHeader[0], BMP_HEADER_SIZE-2 );
+	if (pOptions->pOutputDir && (strlen( pOptions->pOutputDir ) + 2 > (size_t) MAX_DIR_NAME))
+	{
+		printf( "WARNING: -out directory name longer than %d characters, using the current directory\n", MAX_DIR_NAME - 2 );
+		pOptions->pOutputDir = NULL;
+	}
+}
 
-	// Stupid Windows .BMP are upside down so copy scanline by scanline
-	// Otherwise we could simply just write the entire map in one go
-	//     memcpy( pBuffer+BMP_HEADER_SIZE, gWorldMap2D, MAP2D_SIZE        );
+// ========================================
+Decoder_t* create_decoder (const DecodeOptions_t &options)
+{
+	Decoder_t *pDecoder = new Decoder_t(); // () = zero initialize
+	pDecoder->options = options;
+	validate_options( &pDecoder->options );
 
-	uint32_t *pSrc = gWorldMap2D + MAP2D_SIZE/4 - MAP2D_IMAGE_W; // start on bottom scanline, iterate to top
-	uint8_t  *pDst = pBuffer + BMP_HEADER_SIZE;
+	if (pDecoder->options.pMapFile)
+		pDecoder->pMapFile = pDecoder->options.pMapFile;
+	else
+		pDecoder->pMapFile = pDecoder->options.bBaked ? BAKED_FILE : MAP_FILENAME;
 
-	for (int y = 0; y < MAP2D_IMAGE_H; ++y)
+	const char *pDir = pDecoder->options.pOutputDir;
+	if (pDir && *pDir)
 	{
-		memcpy( pDst, pSrc, MAP2D_IMAGE_W*4 ); // 4 = RGBA channels
-
-		// Stupid Windows .BMP need to swizzle ABGR -> ARGB otherwise we could do a simple scanline copy
-		for (int x = 0; x < MAP2D_IMAGE_W; ++x)
-		{
-			uint8_t red  = pDst[0];
-			uint8_t blue = pDst[2];
-			               pDst[2] = red;
-			               pDst[0] = blue;
-			pDst   += 4;
-		}
-		pSrc -= MAP2D_IMAGE_W;
+		const size_t nLen = strlen( pDir );
+		const bool   bSep = (pDir[ nLen-1 ] == '/') || (pDir[ nLen-1 ] == '\\');
+		sprintf( pDecoder->sOutputDir, "%s%s", pDir, bSep ? "" : "/" );
 	}
 
-	char sFileName[256];
-	sprintf( sFileName, "WorldMap2D_%dx%d_rooms.bmp", MAP2D_ROOW_W, MAP2D_ROOM_H );
-	write_file( sFileName, pBuffer, aHeader[0] );
+	pDecoder->assets = gAssets;
 
-	delete [] pBuffer;
+	init_shared();
+	begin_metrics( pDecoder );
+	return pDecoder;
 }
 
-
-// Write texture atlas 32 bpp, 256x256 px
 // ========================================
-void write_tiles32bpp ()
+void free_decoder (Decoder_t *pDecoder)
 {
-	char sFileName[256];
-	sprintf( sFileName, "tiles_%dx%d_rgba32_%dx%d.data", ATLAS_W, ATLAS_H, ATLAS_IMAGE_W, ATLAS_IMAGE_H );
-	write_file( sFileName, gTilesRGBA, sizeof( gTilesRGBA ) );
+	if (!pDecoder)
+		return;
+
+	free_surface( &pDecoder->worldMap1D );
+	free_surface( &pDecoder->worldMap2D );
+	free_surface( &pDecoder->indexMap1D );
+	free_surface( &pDecoder->indexMap2D );
+	free_surface( &pDecoder->bitmap2D   );
+
+	delete [] pDecoder->aRoomIndex;
+	delete [] pDecoder->aRooms;
+	delete [] pDecoder->aRoomHash;
+	delete [] pDecoder->aRoomDedup;
+	delete [] pDecoder->aBakedDesc;
+	free_labels( &pDecoder->labels );
+
+	unmap_file( &pDecoder->map );
+	close_perf( &pDecoder->metrics );
+	delete pDecoder;
 }
 
 // ========================================
-void write_files ()
+int load_world (Decoder_t *pDecoder)
 {
-	write_tiles32bpp();
-	write_map1C_rgba32();
-	write_map2D_rgba32();
+	int nRooms = 0;
+	if (pDecoder->options.bBaked)
+	{
+		if (!load_baked( pDecoder ))
+			return -1;
+		nRooms = pDecoder->world.nRooms;
+		end_stage( pDecoder, "load_baked" );
+	}
+	else
+	{
+		load_assets( pDecoder );
+		end_stage( pDecoder, "load_assets" );
+
+		if (!read_map( pDecoder ))
+			return -1;
+		end_stage( pDecoder, "read_map" );
+
+		nRooms = count_rooms( pDecoder );
+		if (nRooms < 0)
+			return -1;
+		printf( "Found: %d rooms\n", nRooms );
+		if (nRooms != pDecoder->mapHeader.nRooms)
+			printf( "ERROR: Map contains unexpected number of rooms! %d != %d\n", nRooms, pDecoder->mapHeader.nRooms );
+		end_stage( pDecoder, "count_rooms" );
+	}
+
+	index_rooms( pDecoder );
+	if (pDecoder->options.bIncremental)
+		hash_rooms( pDecoder );
+	end_stage( pDecoder, "index_rooms" );
+
+	dedup_rooms( pDecoder );
+	end_stage( pDecoder, "dedup_rooms" );
+
+	make_labels( pDecoder );
+	end_stage( pDecoder, "make_labels" );
 
-	write_map2D_bitmap();
-	dump_histogram();
+	return nRooms;
 }
 
 // ========================================
-int main(int nArcg, char *aArg[])
+void write_world (Decoder_t *pDecoder)
 {
-	char directory[FILENAME_MAX];
-	char* path = getcwd(directory, sizeof(directory) - 1);
-	printf("Current Directory: %s\n", path);
+	const int nRooms = pDecoder->world.nRooms;
 
-	//pack_CGA_font();
-	unpack_CGA_font();
+	if (pDecoder->options.bStream)
+	{
+		stream_files( pDecoder, nRooms );
+		pDecoder->metrics.nRenderSecs = end_stage( pDecoder, "stream_files" ); // drawing overlaps writing
+	}
+	else
+	if (pDecoder->options.bIncremental && update_files( pDecoder, nRooms ))
+		pDecoder->metrics.nRenderSecs = end_stage( pDecoder, "update_files" );
+	else
+	{
+		if (pDecoder->options.bIncremental)
+			end_stage( pDecoder, "update_files" ); // no usable cache, full rebuild
 
-	read_files();
+		draw_rooms( pDecoder, nRooms );
+		pDecoder->metrics.nRenderSecs = end_stage( pDecoder, "draw_rooms" );
 
-	int nRooms = count_rooms();
-	printf( "Found: %d rooms\n", nRooms );
-	if (nRooms != MAP1C_ROOM_H)
-		printf( "ERROR: Map contains unexpected number of rooms! %d != %d\n", nRooms, MAP1C_ROOM_H );
+		write_files( pDecoder );
+		end_stage( pDecoder, "write_files" );
+	}
 
-	convert_tiles_8bpp_32rgba();
-	draw_rooms(nRooms);
+	if (pDecoder->options.bIncremental)
+	{
+		save_cache( pDecoder );
+		end_stage( pDecoder, "save_cache" );
+	}
 
-	write_files();
-	return 0;
+	write_metrics( pDecoder );
 }
@@ -0,0 +1,88 @@
+/*
+    Decoder for the "You Have To Win The Game" World Map, see decode.cpp
+
+    Every map is decoded by its own Decoder_t: rooms, World Maps, tile histogram and metrics.
+    The texture atlas and blitter are set up once per process, the font and palettes are compile time
+    tables. All are shared read-only by the decoders, so several maps can be decoded at the same time
+    on different threads.
+
+    Usage:
+        DecodeOptions_t options;
+        options.pMapFile   = "yhtwtg.map";
+        options.pOutputDir = "out";
+
+        Decoder_t *pDecoder = create_decoder( options );
+        if (load_world( pDecoder ) >= 0)
+            write_world( pDecoder );
+        free_decoder( pDecoder );
+*/
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stddef.h> // NULL
+#include <stdint.h> // uint32_t
+
+	// What to read, what to write and how. The command line flag of each option is in main.cpp.
+	// Strings are not copied: they must outlive the decoder.
+	struct DecodeOptions_t
+	{
+		bool        bRender1D    = true;  // -no1d: skip the single column World Map and its buffer
+		int         nThreads     = 1;     // -threads #: 0 = one per core
+		bool        bIndexed     = false; // -indexed: render 8-bpp palette indices, expand when writing
+		bool        bStream      = false; // -stream: no full size World Maps, one band of rooms at a time
+		bool        bRawData     = true;  // -nodata: skip raw .data World Maps, render the .BMP directly
+		bool        bMapOutput   = false; // -mmap: render straight into memory-mapped output files
+		bool        bPNG         = false; // -png: also write the World Maps as .PNG
+		bool        bDeepZoom    = false; // -dzi: also write a Deep Zoom tile pyramid of the 2D World Map
+		bool        bIncremental = false; // -incremental: only re-render rooms changed since the last run
+		bool        bBaked       = false; // -baked: pMapFile is a baked world, see write_baked()
+		bool        bQuiet       = false; // -quiet: no per-room, per-tile or per-file log lines
+		bool        bPerf        = false; // -perf: hardware counters per stage, Linux only
+		int         nBitmapBits  = 32;    // -bmp 4|8: indexed .BMP with the CGA palette, implies bIndexed
+		const char *pMapFile     = NULL;  // -map file: NULL = yhtwtg.map, or yhtwtg.baked with bBaked
+		const char *pOutputDir   = NULL;  // -out dir: where every output file goes, NULL = current directory. Must exist.
+		const char *pMetricsFile = NULL;  // -metrics [file]: JSON report written by write_world(), write_baked() and write_region()
+	};
+
+	struct Decoder_t; // one map, see decode.cpp
+
+	// Invalid option combinations are fixed up with a WARNING
+	Decoder_t* create_decoder (const DecodeOptions_t &options);
+	void       free_decoder   (Decoder_t *pDecoder);
+
+	// Map the .map (or baked world) and index its rooms. Returns the number of rooms, -1 on error.
+	int        load_world     (Decoder_t *pDecoder);
+
+	// Render and write every World Map the options ask for
+	void       write_world    (Decoder_t *pDecoder);
+
+	// Save the loaded world, converted atlas and unpacked font as yhtwtg.baked
+	void       write_baked    (Decoder_t *pDecoder);
+
+	// Save yhtwtg_repacked.baked: the world with an atlas of only the used tiles, most drawn first, and the
+	// rooms' tiles renumbered into it. Render it with -baked. The compact atlas is also saved as .data and .png.
+	void       write_repacked (Decoder_t *pDecoder);
+
+	// Count which atlas tiles every room uses, without rendering, and write them as yhtwtg.tiles.json:
+	// per tile its count and rooms, per room its tiles, and which tiles share rooms
+	void       write_tile_stats (Decoder_t *pDecoder);
+
+	// Find near duplicate rooms and rooms that are copies moved by a few tiles, and write them with the map of
+	// exact duplicates (which write_world() draws as copies) as yhtwtg.similar.json
+	void       write_similar_rooms (Decoder_t *pDecoder);
+
+	// Render the nWidth x nHeight px rectangle of the 2D World Map at nWorldX, nWorldY into caller memory, nPitch px
+	// per scanline: 32-bit RGBA (bytes R,G,B,A) or 8-bit CGA palette indices. Empty cells and anything outside
+	// the World Map are transparent. Only writes pPixels, so several threads can render from one loaded decoder.
+	// Returns false before load_world() or if the rectangle doesn't fit the pitch.
+	bool       render_region  (const Decoder_t *pDecoder, const int nWorldX, const int nWorldY, const int nWidth, const int nHeight, uint32_t *pPixels, const int nPitch);
+	bool       render_region  (const Decoder_t *pDecoder, const int nWorldX, const int nWorldY, const int nWidth, const int nHeight, uint8_t  *pPixels, const int nPitch);
+
+	// -region: render_region() to a raw .data
+	void       write_region   (Decoder_t *pDecoder, const int nWorldX, const int nWorldY, const int nWidth, const int nHeight);
+
+	// Benchmarks, report to stdout. They only write the decoder's own buffers and output files.
+	void       bench_blit     (Decoder_t *pDecoder);
+	void       bench_stages   (Decoder_t *pDecoder, const int nScale);
+
+#endif // DECODE_H
@@ -0,0 +1,192 @@
+/*
+    Command line front end of the "You Have To Win The Game" World Map decoder, see decode.cpp
+
+    Options:
+        -no1d        Skip the single column World Map (2D map is rendered directly)
+        -threads #   Render rooms on # threads, 0 = all cores (default: 1)
+        -benchblit   Report throughput of the scalar and SIMD blitters, then exit
+        -indexed     Render 8-bpp palette indices, expand to 32-bpp only when writing
+        -stream      Render one band of rooms at a time straight to the output files (bounded memory)
+        -nodata      Skip the raw .data World Maps; the 2D map is rendered directly in .BMP byte order
+        -mmap        Size and memory-map the output files, then render directly into them
+        -bmp #       .BMP bits per pixel: 32 (default), 8 or 4 with the CGA palette; implies -indexed
+        -png         Also write the World Maps as .png, deflated in parallel strips (indexed color with -indexed)
+        -dzi         Also write a Deep Zoom (.dzi) pyramid of 256x256 .png tiles of the 2D World Map
+        -region x y w h  Only render the w x h px rectangle of the 2D World Map at x,y to a raw .data
+        -incremental Only re-render rooms changed since the last run and patch them into the existing files
+        -bake        Write yhtwtg.baked (rooms, titles, converted atlas and unpacked font) then exit
+        -repack      Write yhtwtg_repacked.baked (only the used tiles, most drawn first) and the compact atlas then exit
+        -tiles       Write yhtwtg.tiles.json (tile counts, rooms per tile, tiles per room, tile co-occurrence) then exit
+        -similar     Write yhtwtg.similar.json (duplicate, near duplicate and shifted rooms, dedup map) then exit
+        -bench #     Time each stage on a synthetic map # times the world (default 1), then exit
+        -quiet       No per-room, per-tile or per-file log lines
+        -metrics [file]  Write a JSON report: seconds per stage, bytes read/written, peak RSS, rooms/s, tile histogram (default: metrics.json)
+        -perf        Add cycles, instructions, cache and branch misses per stage to -metrics and -bench (Linux perf_event_open)
+        -baked       Map yhtwtg.baked and render from it: no .map parsing, atlas conversion or font unpacking
+        -map file    Read this .map instead of yhtwtg.map (or this baked world instead of yhtwtg.baked with -baked)
+        -out dir     Write every output file into this existing directory instead of the current one
+*/
+#define _CRT_SECURE_NO_WARNINGS // MSVC bullshit
+
+#include <stdio.h>  // printf()
+#include <string.h> // strcmp()
+#include <stdlib.h> // atoi()
+
+#if _WIN32
+    #include <direct.h>   // Win: _getcwd()
+    #define getcwd _getcwd
+#else
+    #include <unistd.h>   // Unix: getcwd()
+#endif
+
+#include "decode.h"
+
+// Globals ____________________________________________________________
+
+	// Actions, the rest of the options are in DecodeOptions_t
+	bool gbBenchBlit  = false;
+	bool gbRegion     = false;
+	bool gbBake       = false;
+	bool gbTileStats  = false;
+	bool gbRepack     = false;
+	bool gbSimilar    = false;
+	int  gnBenchScale = 0;
+	int  gaRegion[4]  = { 0, 0, 0, 0 }; // x, y, w, h
+
+// Main _______________________________________________________________
+
+// ========================================
+void parse_args (int nArg, char *aArg[], DecodeOptions_t *pOptions)
+{
+	for (int iArg = 1; iArg < nArg; ++iArg)
+	{
+		const char *pArg = aArg[ iArg ];
+
+		if (strcmp( pArg, "-no1d" ) == 0)
+			pOptions->bRender1D = false;
+		else
+		if ((strcmp( pArg, "-threads" ) == 0) && (iArg+1 < nArg))
+			pOptions->nThreads = atoi( aArg[ ++iArg ] );
+		else
+		if (strcmp( pArg, "-benchblit" ) == 0)
+			gbBenchBlit = true;
+		else
+		if (strcmp( pArg, "-indexed" ) == 0)
+			pOptions->bIndexed = true;
+		else
+		if (strcmp( pArg, "-stream" ) == 0)
+			pOptions->bStream = true;
+		else
+		if (strcmp( pArg, "-nodata" ) == 0)
+			pOptions->bRawData = false;
+		else
+		if (strcmp( pArg, "-mmap" ) == 0)
+			pOptions->bMapOutput = true;
+		else
+		if (strcmp( pArg, "-png" ) == 0)
+			pOptions->bPNG = true;
+		else
+		if (strcmp( pArg, "-dzi" ) == 0)
+			pOptions->bDeepZoom = true;
+		else
+		if (strcmp( pArg, "-incremental" ) == 0)
+			pOptions->bIncremental = true;
+		else
+		if (strcmp( pArg, "-bake" ) == 0)
+			gbBake = true;
+		else
+		if (strcmp( pArg, "-repack" ) == 0)
+			gbRepack = true;
+		else
+		if (strcmp( pArg, "-similar" ) == 0)
+			gbSimilar = true;
+		else
+		if (strcmp( pArg, "-tiles" ) == 0)
+			gbTileStats = true;
+		else
+		if (strcmp( pArg, "-baked" ) == 0)
+			pOptions->bBaked = true;
+		else
+		if (strcmp( pArg, "-quiet" ) == 0)
+			pOptions->bQuiet = true;
+		else
+		if (strcmp( pArg, "-metrics" ) == 0)
+		{
+			pOptions->pMetricsFile = "metrics.json";
+			if ((iArg+1 < nArg) && (aArg[ iArg+1 ][0] != '-'))
+				pOptions->pMetricsFile = aArg[ ++iArg ];
+		}
+		else
+		if (strcmp( pArg, "-perf" ) == 0)
+			pOptions->bPerf = true;
+		else
+		if (strcmp( pArg, "-bench" ) == 0)
+		{
+			gnBenchScale = 1;
+			if ((iArg+1 < nArg) && (atoi( aArg[ iArg+1 ] ) > 0))
+				gnBenchScale = atoi( aArg[ ++iArg ] );
+		}
+		else
+		if ((strcmp( pArg, "-region" ) == 0) && (iArg+4 < nArg))
+		{
+			gbRegion = true;
+			for (int i = 0; i < 4; ++i)
+				gaRegion[ i ] = atoi( aArg[ ++iArg ] );
+		}
+		else
+		if ((strcmp( pArg, "-bmp" ) == 0) && (iArg+1 < nArg))
+			pOptions->nBitmapBits = atoi( aArg[ ++iArg ] );
+		else
+		if ((strcmp( pArg, "-map" ) == 0) && (iArg+1 < nArg))
+			pOptions->pMapFile = aArg[ ++iArg ];
+		else
+		if ((strcmp( pArg, "-out" ) == 0) && (iArg+1 < nArg))
+			pOptions->pOutputDir = aArg[ ++iArg ];
+		else
+			printf( "WARNING: Unknown option: %s\n", pArg );
+	}
+}
+
+// ========================================
+int main(int nArcg, char *aArg[])
+{
+	DecodeOptions_t options;
+	parse_args( nArcg, aArg, &options );
+
+	char directory[FILENAME_MAX];
+	char* path = getcwd(directory, sizeof(directory) - 1);
+	printf("Current Directory: %s\n", path);
+
+	Decoder_t *pDecoder = create_decoder( options );
+	if (load_world( pDecoder ) < 0)
+	{
+		free_decoder( pDecoder );
+		return 1;
+	}
+
+	if (gbBake)
+		write_baked( pDecoder );
+	else
+	if (gbRepack)
+		write_repacked( pDecoder );
+	else
+	if (gbSimilar)
+		write_similar_rooms( pDecoder );
+	else
+	if (gbTileStats)
+		write_tile_stats( pDecoder );
+	else
+	if (gbBenchBlit)
+		bench_blit( pDecoder );
+	else
+	if (gnBenchScale)
+		bench_stages( pDecoder, gnBenchScale );
+	else
+	if (gbRegion)
+		write_region( pDecoder, gaRegion[0], gaRegion[1], gaRegion[2], gaRegion[3] );
+	else
+		write_world( pDecoder );
+
+	free_decoder( pDecoder );
+	return 0;
+}